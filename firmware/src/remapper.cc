@@ -23,6 +23,21 @@ const uint8_t MAPPING_FLAG_STICKY = 1 << 0;
 const uint8_t MAPPING_FLAG_TAP = 1 << 1;
 const uint8_t MAPPING_FLAG_HOLD = 1 << 2;
 
+const uint8_t SOURCE_FLAG_STICKY = 1 << 0;
+const uint8_t SOURCE_FLAG_TAP = 1 << 1;
+const uint8_t SOURCE_FLAG_HOLD = 1 << 2;
+const uint8_t SOURCE_FLAG_RELATIVE = 1 << 3;
+const uint8_t SOURCE_FLAG_BINARY = 1 << 4;
+const uint8_t SOURCE_FLAG_FIXED_POINT = 1 << 5;  // expression and register values are * 1000
+
+const uint8_t TARGET_FLAG_RELATIVE = 1 << 0;
+const uint8_t TARGET_FLAG_REGISTER = 1 << 1;
+const uint8_t TARGET_FLAG_SCROLL = 1 << 2;
+const uint8_t TARGET_FLAG_ALWAYS_DIRTY = 1 << 3;  // depends on time (tap/hold), evaluated every frame
+const uint8_t TARGET_FLAG_IN_REPORT = 1 << 4;        // has usages in our input reports
+const uint8_t TARGET_FLAG_EXCLUSIVE = 1 << 5;        // ...that aren't arrays and don't overlap other targets' usages
+const uint8_t TARGET_FLAG_OUTSIDE_REPORTS = 1 << 6;  // has usages elsewhere (GPIO, registers, OUTPUT reports), written every frame
+
 const uint8_t V_RESOLUTION_BITMASK = (1 << 0);
 const uint8_t H_RESOLUTION_BITMASK = (1 << 2);
 const uint32_t V_SCROLL_USAGE = 0x00010038;
@@ -47,15 +62,14 @@ const uint8_t resolution_multiplier_masks[] = {
 std::vector<reverse_mapping_t> reverse_mapping;
 std::vector<reverse_mapping_t> reverse_mapping_macros;
 std::vector<reverse_mapping_t> reverse_mapping_layers;
+mapping_program_t mapping_program;
 
 std::unordered_map<uint8_t, std::unordered_map<uint32_t, usage_def_t>> our_usages;  // report_id -> usage -> usage_def
 std::unordered_map<uint32_t, usage_def_t> our_usages_flat;
 bool have_dpad = false;
 usage_def_t our_dpad_usage;  // only valid if have_dpad is true
 
-std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<usage_usage_def_t>>> their_used_usages;  // dev_addr+interface -> report_id -> (usage, usage_def) vector
-std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<int32_t*>>> array_range_usages;          // dev_addr+interface -> report_id -> input_state ptr vector
-std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<usage_def_t>>> rollover_usages;          // dev_addr+interface -> report_id -> usage_def vector
+decode_program_t decode_program;
 
 std::vector<sticky_usage_t> sticky_usages;
 std::vector<tap_hold_sticky_usage_t> tap_sticky_usages;
@@ -71,6 +85,14 @@ uint8_t* report_masks_relative[MAX_INPUT_REPORT_ID + 1];
 uint8_t* report_masks_absolute[MAX_INPUT_REPORT_ID + 1];
 uint16_t report_sizes[MAX_INPUT_REPORT_ID + 1];
 
+// Absolute targets are put into these images of our input reports only when their
+// value changes, and every frame's report starts out as a copy of its image. A
+// TARGET_FLAG_EXCLUSIVE target is updated in place, other changes get the image
+// rebuilt from its template (what clear_report() leaves) and all targets' values.
+alignas(4) uint8_t report_images[MAX_INPUT_REPORT_ID + 1][MAX_REPORT_SIZE];
+alignas(4) uint8_t report_templates[MAX_INPUT_REPORT_ID + 1][MAX_REPORT_SIZE];
+uint8_t stale_report_images = 0;  // bit per report ID
+
 #define OR_BUFSIZE 8
 uint8_t outgoing_reports[OR_BUFSIZE][MAX_REPORT_SIZE + 1];
 uint8_t or_head = 0;
@@ -84,10 +106,37 @@ std::vector<uint8_t> report_ids;
 
 int32_t input_state[MAX_INPUT_STATES * 2];
 tap_hold_state_t tap_hold_state[MAX_INPUT_STATES];
-uint8_t sticky_state[MAX_INPUT_STATES];                  // state per layer (mask)
-std::unordered_map<uint64_t, int32_t*> usage_state_ptr;  // usage -> input_state pointer
+uint8_t sticky_state[MAX_INPUT_STATES];  // state per layer (mask)
 uint32_t used_state_slots = 0;
 
+// (raw, hub_port, usage) -> input_state slot lookup. Open addressing with linear probing,
+// at most half full. The hash multiplier is picked when the mapping is compiled
+// so that the longest probe sequence is as short as possible (usually zero).
+#define STATE_TABLE_BITS 11
+#define STATE_TABLE_SIZE (1 << STATE_TABLE_BITS)
+
+uint64_t state_slot_key[MAX_INPUT_STATES];  // input_state slot -> key
+uint16_t state_table[STATE_TABLE_SIZE];     // input_state slot + 1, zero if empty
+uint64_t state_table_multiplier = 0x9E3779B97F4A7C15;
+uint32_t state_table_max_probe = 0;
+
+const uint64_t state_table_multipliers[] = {
+    0x9E3779B97F4A7C15,
+    0xC2B2AE3D27D4EB4F,
+    0x165667B19E3779F9,
+    0xD6E8FEB86659FD93,
+    0xFF51AFD7ED558CCD,
+    0xC4CEB9FE1A85EC53,
+    0x94D049BB133111EB,
+    0xBF58476D1CE4E5B9,
+};
+
+// input_state slots that changed since the mapping program last looked at them
+uint32_t dirty_state_slots[MAX_INPUT_STATES / 32];
+bool all_targets_dirty = true;
+uint8_t prev_layer_state_mask = 0;
+uint16_t prev_active_ports_mask = 0;
+
 std::unordered_map<uint32_t, int32_t> accumulated;  // usage -> relative movement, * 1000
 uint8_t layer_state_mask = 1;
 
@@ -103,6 +152,8 @@ std::queue<macro_entry_t> macro_queue;
 uint32_t reports_received;
 uint32_t reports_sent;
 uint32_t processing_time;
+uint32_t report_bytes_decoded;
+uint32_t report_bytes_skipped;
 
 bool expression_valid[NEXPRESSIONS] = { false };
 
@@ -125,21 +176,23 @@ uint16_t active_ports_mask = 0;
 
 uint8_t dpad_state = 0;
 
-inline int32_t handle_scroll(map_source_t& map_source, uint32_t target_usage, int32_t movement, uint64_t now) {
+inline int32_t handle_scroll(uint16_t source, uint32_t target_usage, int32_t movement, uint64_t now) {
     // movement is always non-zero
     int32_t ret = 0;
     if (resolution_multiplier &
         resolution_multiplier_masks[target_usage == H_SCROLL_USAGE]) {  // hi-res
         ret = movement;
     } else {  // lo-res
-        if ((map_source.accumulated_scroll != 0) &&
-            (now - map_source.last_scroll_timestamp > partial_scroll_timeout)) {
-            map_source.accumulated_scroll = 0;
-        }
-        map_source.last_scroll_timestamp = now;
-        map_source.accumulated_scroll += movement;
-        int ticks = map_source.accumulated_scroll / (1000 * RESOLUTION_MULTIPLIER);
-        map_source.accumulated_scroll -= ticks * (1000 * RESOLUTION_MULTIPLIER);
+        int32_t& accumulated_scroll = mapping_program.source_accumulated_scroll[source];
+        uint64_t& last_scroll_timestamp = mapping_program.source_last_scroll_timestamp[source];
+        if ((accumulated_scroll != 0) &&
+            (now - last_scroll_timestamp > partial_scroll_timeout)) {
+            accumulated_scroll = 0;
+        }
+        last_scroll_timestamp = now;
+        accumulated_scroll += movement;
+        int ticks = accumulated_scroll / (1000 * RESOLUTION_MULTIPLIER);
+        accumulated_scroll -= ticks * (1000 * RESOLUTION_MULTIPLIER);
         ret = ticks * 1000;
     }
     return ret;
@@ -177,6 +230,106 @@ inline void put_bits(uint8_t* data, int len, uint16_t bitpos, uint8_t size, uint
     }
 }
 
+// For arrays (count > 1) the kernel has to work for every element.
+BitsKernel pick_bits_kernel(uint16_t bitpos, uint8_t size, uint32_t count) {
+    if (((bitpos % 8) == 0) && ((count <= 1) || ((size % 8) == 0))) {
+        switch (size) {
+            case 8:
+                return BitsKernel::ALIGNED_8;
+            case 16:
+                return BitsKernel::ALIGNED_16;
+            case 32:
+                return BitsKernel::ALIGNED_32;
+        }
+    }
+    if ((size > 0) && ((size <= 25) || ((count <= 1) && ((bitpos % 8) + size <= 32)))) {
+        return BitsKernel::WINDOW;
+    }
+    return BitsKernel::GENERIC;
+}
+
+// Same results as the bit-by-bit versions above. Fields that extend past len fall back to those.
+inline uint32_t get_bits(BitsKernel kernel, const uint8_t* data, int len, uint16_t bitpos, uint8_t size) {
+    int byte_no = bitpos / 8;
+    switch (kernel) {
+        case BitsKernel::ALIGNED_8:
+            if (byte_no < len) {
+                return data[byte_no];
+            }
+            break;
+        case BitsKernel::ALIGNED_16:
+            if (byte_no + 2 <= len) {
+                return data[byte_no] | (data[byte_no + 1] << 8);
+            }
+            break;
+        case BitsKernel::ALIGNED_32:
+            if (byte_no + 4 <= len) {
+                return data[byte_no] | (data[byte_no + 1] << 8) | (data[byte_no + 2] << 16) | ((uint32_t) data[byte_no + 3] << 24);
+            }
+            break;
+        case BitsKernel::WINDOW: {
+            int shift = bitpos % 8;
+            int nbytes = (shift + size + 7) / 8;
+            if (byte_no + nbytes <= len) {
+                uint32_t window = 0;
+                for (int i = 0; i < nbytes; i++) {
+                    window |= (uint32_t) data[byte_no + i] << (8 * i);
+                }
+                return (window >> shift) & (0xFFFFFFFF >> (32 - size));
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return get_bits(data, len, bitpos, size);
+}
+
+inline void put_bits(BitsKernel kernel, uint8_t* data, int len, uint16_t bitpos, uint8_t size, uint32_t value) {
+    int byte_no = bitpos / 8;
+    switch (kernel) {
+        case BitsKernel::ALIGNED_8:
+            if (byte_no < len) {
+                data[byte_no] = value;
+                return;
+            }
+            break;
+        case BitsKernel::ALIGNED_16:
+            if (byte_no + 2 <= len) {
+                data[byte_no] = value;
+                data[byte_no + 1] = value >> 8;
+                return;
+            }
+            break;
+        case BitsKernel::ALIGNED_32:
+            if (byte_no + 4 <= len) {
+                data[byte_no] = value;
+                data[byte_no + 1] = value >> 8;
+                data[byte_no + 2] = value >> 16;
+                data[byte_no + 3] = value >> 24;
+                return;
+            }
+            break;
+        case BitsKernel::WINDOW: {
+            int shift = bitpos % 8;
+            int nbytes = (shift + size + 7) / 8;
+            if (byte_no + nbytes <= len) {
+                uint32_t mask = (0xFFFFFFFF >> (32 - size)) << shift;
+                uint32_t shifted = value << shift;
+                for (int i = 0; i < nbytes; i++) {
+                    uint8_t byte_mask = mask >> (8 * i);
+                    data[byte_no + i] = (data[byte_no + i] & ~byte_mask) | ((shifted >> (8 * i)) & byte_mask);
+                }
+                return;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    put_bits(data, len, bitpos, size, value);
+}
+
 bool needs_to_be_sent(uint8_t report_id) {
     uint8_t* report = reports[report_id];
     uint8_t* prev_report = prev_reports[report_id];
@@ -330,30 +483,99 @@ void invalidate_expr_state_ptr_cache() {
     }
 }
 
+inline uint64_t state_key(uint32_t usage, uint8_t hub_port, bool raw) {
+    return (raw ? ((uint64_t) 1 << 40) : 0) | ((uint64_t) hub_port << 32) | usage;
+}
+
+inline uint32_t state_table_home(uint64_t key) {
+    return (key * state_table_multiplier) >> (64 - STATE_TABLE_BITS);
+}
+
+// returns the input_state slot or -1
+inline int32_t find_state_slot(uint64_t key) {
+    uint32_t pos = state_table_home(key);
+    for (uint32_t probe = 0; probe <= state_table_max_probe; probe++) {
+        uint16_t entry = state_table[(pos + probe) & (STATE_TABLE_SIZE - 1)];
+        if (entry == 0) {
+            return -1;
+        }
+        if (state_slot_key[entry - 1] == key) {
+            return entry - 1;
+        }
+    }
+    return -1;
+}
+
+void state_table_insert(uint16_t slot) {
+    uint32_t pos = state_table_home(state_slot_key[slot]);
+    uint32_t probe = 0;
+    while (state_table[(pos + probe) & (STATE_TABLE_SIZE - 1)] != 0) {
+        probe++;
+    }
+    state_table[(pos + probe) & (STATE_TABLE_SIZE - 1)] = slot + 1;
+    if (probe > state_table_max_probe) {
+        state_table_max_probe = probe;
+    }
+}
+
+void clear_state_table() {
+    memset(state_table, 0, sizeof(state_table));
+    state_table_max_probe = 0;
+}
+
+// Try a few hash multipliers and keep the one with the shortest longest probe sequence.
+void rebuild_state_table() {
+    uint64_t best_multiplier = state_table_multipliers[0];
+    uint32_t best_max_probe = UINT32_MAX;
+    for (uint64_t multiplier : state_table_multipliers) {
+        state_table_multiplier = multiplier;
+        clear_state_table();
+        for (uint32_t slot = 0; slot < used_state_slots; slot++) {
+            state_table_insert(slot);
+        }
+        if (state_table_max_probe < best_max_probe) {
+            best_max_probe = state_table_max_probe;
+            best_multiplier = multiplier;
+        }
+        if (best_max_probe == 0) {
+            break;
+        }
+    }
+    if (state_table_multiplier != best_multiplier) {
+        state_table_multiplier = best_multiplier;
+        clear_state_table();
+        for (uint32_t slot = 0; slot < used_state_slots; slot++) {
+            state_table_insert(slot);
+        }
+    }
+}
+
 bool assign_state_slot(uint32_t usage, uint8_t hub_port, bool raw) {
-    uint64_t key = (raw ? ((uint64_t) 1 << 40) : 0) | ((uint64_t) hub_port << 32) | usage;
-    if (usage_state_ptr.count(key) == 0) {
+    uint64_t key = state_key(usage, hub_port, raw);
+    if (find_state_slot(key) < 0) {
         if (used_state_slots >= MAX_INPUT_STATES) {
             printf("out of input_state slots!");
             return false;
         }
 
-        usage_state_ptr[key] = input_state + used_state_slots++;
+        state_slot_key[used_state_slots] = key;
+        state_table_insert(used_state_slots);
+        used_state_slots++;
     }
     return true;
 }
 
 inline int32_t* get_state_ptr(uint32_t usage, uint8_t hub_port, bool assign_if_absent = false, bool raw = false) {
-    uint64_t key = (raw ? ((uint64_t) 1 << 40) : 0) | ((uint64_t) hub_port << 32) | usage;
-    auto search = usage_state_ptr.find(key);
-    if (search != usage_state_ptr.end()) {
-        return search->second;
+    uint64_t key = state_key(usage, hub_port, raw);
+    int32_t slot = find_state_slot(key);
+    if (slot >= 0) {
+        return input_state + slot;
     }
 
     if (assign_if_absent) {
         if (assign_state_slot(usage, hub_port, raw)) {
             their_descriptor_updated = true;
-            return usage_state_ptr[key];  // it's zero, but maybe someone wants to write to it
+            return input_state + used_state_slots - 1;  // it's zero, but maybe someone wants to write to it
         }
     }
 
@@ -378,6 +600,21 @@ inline uint8_t* get_sticky_state_ptr(uint32_t usage, uint8_t hub_port, bool assi
     return NULL;
 }
 
+inline void mark_slot_dirty(uint32_t slot) {
+    dirty_state_slots[slot / 32] |= 1 << (slot % 32);
+}
+
+inline void mark_state_dirty(const int32_t* state_ptr) {
+    mark_slot_dirty(state_ptr - input_state);
+}
+
+inline void update_state(int32_t* state_ptr, int32_t value) {
+    if (*state_ptr != value) {
+        *state_ptr = value;
+        mark_state_dirty(state_ptr);
+    }
+}
+
 void set_mapping_from_config() {
     std::unordered_map<uint64_t, std::vector<map_source_t>> reverse_mapping_map;  // hub_port+target -> sources list
     std::unordered_map<uint64_t, uint8_t> sticky_usage_map;
@@ -393,7 +630,7 @@ void set_mapping_from_config() {
     reverse_mapping_macros.clear();
     reverse_mapping_layers.clear();
     used_state_slots = 0;
-    usage_state_ptr.clear();
+    clear_state_table();
     register_ptrs.clear();
     memset(input_state, 0, sizeof(input_state));
     memset(tap_hold_state, 0, sizeof(tap_hold_state));
@@ -665,12 +902,13 @@ void set_mapping_from_config() {
             for (auto const& array_usage : our_array_range_usages) {
                 if ((target >= array_usage.usage) && (target <= array_usage.usage_def.usage_maximum)) {
                     rev_map.our_usages.push_back((out_usage_def_t){
-                        .data = reports[array_usage.usage_def.report_id],
+                        .data = NULL,
                         .len = report_sizes[array_usage.usage_def.report_id],
                         .size = array_usage.usage_def.size,
                         .bitpos = array_usage.usage_def.bitpos,
                         .array_count = array_usage.usage_def.count,
                         .array_index = array_usage.usage_def.logical_minimum + target - array_usage.usage,
+                        .report_id = array_usage.usage_def.report_id,
                     });
                     handled = true;
                     break;
@@ -681,10 +919,11 @@ void set_mapping_from_config() {
                 if (search != our_usages_flat.end()) {
                     const usage_def_t& our_usage = search->second;
                     rev_map.our_usages.push_back((out_usage_def_t){
-                        .data = reports[our_usage.report_id],
+                        .data = NULL,
                         .len = report_sizes[our_usage.report_id],
                         .size = our_usage.size,
                         .bitpos = our_usage.bitpos,
+                        .report_id = our_usage.report_id,
                     });
                     rev_map.is_relative = our_usage.is_relative;
                 }
@@ -718,21 +957,21 @@ bool differ_on_absolute(const uint8_t* report1, const uint8_t* report2, uint8_t
 void aggregate_relative(uint8_t* prev_report, const uint8_t* report, uint8_t report_id) {
     for (auto const& [usage, usage_def] : our_usages[report_id]) {
         if (usage_def.is_relative) {
-            int32_t val1 = get_bits(report, report_sizes[report_id], usage_def.bitpos, usage_def.size);
+            int32_t val1 = get_bits(usage_def.bits_kernel, report, report_sizes[report_id], usage_def.bitpos, usage_def.size);
             if (usage_def.logical_minimum < 0) {
                 if (val1 & (1 << (usage_def.size - 1))) {
                     val1 |= 0xFFFFFFFF << usage_def.size;
                 }
             }
             if (val1) {
-                int32_t val2 = get_bits(prev_report, report_sizes[report_id], usage_def.bitpos, usage_def.size);
+                int32_t val2 = get_bits(usage_def.bits_kernel, prev_report, report_sizes[report_id], usage_def.bitpos, usage_def.size);
                 if (usage_def.logical_minimum < 0) {
                     if (val2 & (1 << (usage_def.size - 1))) {
                         val2 |= 0xFFFFFFFF << usage_def.size;
                     }
                 }
 
-                put_bits(prev_report, report_sizes[report_id], usage_def.bitpos, usage_def.size, val1 + val2);
+                put_bits(usage_def.bits_kernel, prev_report, report_sizes[report_id], usage_def.bitpos, usage_def.size, val1 + val2);
             }
         }
     }
@@ -1091,6 +1330,61 @@ uint8_t get_layer_state_mask(void) {
     return layer_state_mask;
 }
 
+// Targets in our input reports are put into the report's image.
+inline uint8_t* out_usage_def_data(const out_usage_def_t& out_usage_def) {
+    return (out_usage_def.data != NULL) ? out_usage_def.data : report_images[out_usage_def.report_id];
+}
+
+inline void put_usage(const out_usage_def_t& out_usage_def, int32_t value) {
+    uint8_t* data = out_usage_def_data(out_usage_def);
+    if (out_usage_def.array_count == 0) {
+        uint32_t effective_value = value;
+        if ((out_usage_def.size < 32) && (effective_value > ((1u << out_usage_def.size) - 1))) {
+            effective_value = (1 << out_usage_def.size) - 1;
+        }
+        put_bits(out_usage_def.bits_kernel, data, out_usage_def.len, out_usage_def.bitpos, out_usage_def.size, effective_value);
+    } else {  // array range
+        for (int j = 0; j < out_usage_def.array_count; j++) {
+            int32_t existing_val = get_bits(out_usage_def.bits_kernel, data, out_usage_def.len, out_usage_def.bitpos + j * out_usage_def.size, out_usage_def.size);
+            // theoretically zero could be a valid index, but let's ignore that for now
+            if (existing_val == 0) {
+                put_bits(out_usage_def.bits_kernel, data, out_usage_def.len, out_usage_def.bitpos + j * out_usage_def.size, out_usage_def.size, out_usage_def.array_index);
+                break;
+            }
+        }
+        // we don't do RollOver
+    }
+}
+
+// Called when an absolute target with usages in our input reports changes value.
+inline void update_report_images(const mapping_program_t& program, const mapping_target_t& target) {
+    for (uint16_t i = target.our_usages_begin; i < target.our_usages_end; i++) {
+        const out_usage_def_t& out_usage_def = program.our_usages[i];
+        if (out_usage_def.data != NULL) {
+            continue;
+        }
+        uint8_t report_id = out_usage_def.report_id;
+        if (!(target.flags & TARGET_FLAG_EXCLUSIVE)) {
+            stale_report_images |= 1 << report_id;
+        } else if (target.cached_value != target.default_value) {
+            put_usage(out_usage_def, target.cached_value);
+        } else {
+            uint32_t neutral = get_bits(out_usage_def.bits_kernel, report_templates[report_id], out_usage_def.len, out_usage_def.bitpos, out_usage_def.size);
+            put_bits(out_usage_def.bits_kernel, report_images[report_id], out_usage_def.len, out_usage_def.bitpos, out_usage_def.size, neutral);
+        }
+    }
+}
+
+void rebuild_report_image(const mapping_program_t& program, uint8_t report_id) {
+    memcpy(report_images[report_id], report_templates[report_id], report_sizes[report_id]);
+    for (uint16_t i = program.image_usages_begin[report_id]; i < program.image_usages_begin[report_id + 1]; i++) {
+        const mapping_target_t& target = program.targets[program.image_usage_targets[i]];
+        if (target.cached_value != target.default_value) {
+            put_usage(program.our_usages[program.image_usages[i]], target.cached_value);
+        }
+    }
+}
+
 void process_mapping(bool auto_repeat) {
     if (suspended) {
         return;
@@ -1116,12 +1410,14 @@ void process_mapping(bool auto_repeat) {
         if ((layer_state_mask & sticky.layer_mask) &&
             ((*(sticky.input_state + PREV_STATE_OFFSET) == 0) && (*sticky.input_state != 0))) {
             *sticky.sticky_state ^= (layer_state_mask & sticky.layer_mask);
+            mark_slot_dirty(sticky.sticky_state - sticky_state);
         }
     }
 
     for (auto& tap_sticky : tap_sticky_usages) {
         if ((layer_state_mask & tap_sticky.layer_mask) && tap_sticky.tap_hold_state->tap) {
             *tap_sticky.sticky_state ^= (layer_state_mask & tap_sticky.layer_mask);
+            mark_slot_dirty(tap_sticky.sticky_state - sticky_state);
         }
     }
 
@@ -1129,6 +1425,7 @@ void process_mapping(bool auto_repeat) {
         if ((layer_state_mask & hold_sticky.layer_mask) &&
             hold_sticky.tap_hold_state->hold && !hold_sticky.tap_hold_state->prev_hold) {
             *hold_sticky.sticky_state ^= (layer_state_mask & hold_sticky.layer_mask);
+            mark_slot_dirty(hold_sticky.sticky_state - sticky_state);
         }
     }
 
@@ -1153,6 +1450,7 @@ void process_mapping(bool auto_repeat) {
                     (*map_source.sticky_state & map_source.layer_mask) &&
                     (layer_state_mask & (1 << i))) {
                     *map_source.sticky_state &= ~map_source.layer_mask;
+                    mark_slot_dirty(map_source.sticky_state - sticky_state);
                 }
 
                 // Sticky mapping works even if it's not present on the currently active layers.
@@ -1177,12 +1475,12 @@ void process_mapping(bool auto_repeat) {
         int32_t result = eval_expr(i, frame_counter, auto_repeat);
         int32_t* state_ptr = get_state_ptr(EXPR_USAGE_PAGE | (i + 1), 0);
         if (state_ptr != NULL) {
-            *state_ptr = result;
+            update_state(state_ptr, result);
         }
     }
 
     for (auto const& reg_ptr : register_ptrs) {
-        *reg_ptr.state_ptr = *reg_ptr.register_ptr;
+        update_state(reg_ptr.state_ptr, *reg_ptr.register_ptr);
     }
 
     // queue triggered macros
@@ -1214,116 +1512,154 @@ void process_mapping(bool auto_repeat) {
     digipot_state[5] = 0;
     dpad_state = 0;
 
-    for (auto& rev_map : reverse_mapping) {
-        uint32_t target = rev_map.target;
-        bool register_target = (target & 0xFFFF0000) == REGISTER_USAGE_PAGE;
-        if (rev_map.is_relative) {
-            for (auto& map_source : rev_map.sources) {
-                if ((map_source.orig_source_port != 0) &&
-                    !(active_ports_mask & (1 << map_source.orig_source_port))) {
+    mapping_program_t& program = mapping_program;
+
+    // Only absolute targets that depend on a changed input_state slot (or whose
+    // inputs are time-dependent) get re-evaluated, the rest reuse last frame's value.
+    if ((layer_state_mask != prev_layer_state_mask) || (active_ports_mask != prev_active_ports_mask)) {
+        all_targets_dirty = true;
+        prev_layer_state_mask = layer_state_mask;
+        prev_active_ports_mask = active_ports_mask;
+    }
+    if (!all_targets_dirty) {
+        memset(program.target_dirty.data(), 0, program.target_dirty.size());
+        for (uint32_t word = 0; word < (used_state_slots + 31) / 32; word++) {
+            uint32_t bits = dirty_state_slots[word];
+            while (bits) {
+                uint32_t slot = word * 32 + __builtin_ctz(bits);
+                bits &= bits - 1;
+                if (slot + 1 >= program.slot_targets_begin.size()) {
+                    break;
+                }
+                for (uint16_t i = program.slot_targets_begin[slot]; i < program.slot_targets_begin[slot + 1]; i++) {
+                    program.target_dirty[program.slot_targets[i]] = 1;
+                }
+            }
+        }
+    }
+    memset(dirty_state_slots, 0, sizeof(dirty_state_slots));
+
+    for (uint16_t t = 0; t < program.targets.size(); t++) {
+        mapping_target_t& target = program.targets[t];
+        if (target.flags & TARGET_FLAG_RELATIVE) {
+            for (uint16_t i = target.sources_begin; i < target.sources_end; i++) {
+                uint8_t flags = program.source_flags[i];
+                if (!(auto_repeat || (flags & SOURCE_FLAG_RELATIVE))) {
                     continue;
                 }
+                uint16_t port_mask = program.source_port_mask[i];
+                if ((port_mask != 0) && !(active_ports_mask & port_mask)) {
+                    continue;
+                }
+                uint16_t slot = program.source_slot[i];
+                uint8_t layer_mask = program.source_layer_mask[i];
                 int32_t value = 0;
-                if (auto_repeat || map_source.is_relative) {
-                    if (map_source.sticky) {
-                        value = !!(*map_source.sticky_state & map_source.layer_mask) * map_source.scaling;
-                    } else {
-                        if (layer_state_mask & map_source.layer_mask) {
-                            value = map_source.hold ? map_source.tap_hold_state->hold : *map_source.input_state;
-                            if (map_source.is_binary) {
-                                value = !!value;
-                            }
-                            value *= map_source.scaling;
-                            if (((map_source.usage & 0xFFFF0000) == EXPR_USAGE_PAGE) ||
-                                ((map_source.usage & 0xFFFF0000) == REGISTER_USAGE_PAGE)) {
-                                value /= 1000;
-                            }
+                if (flags & SOURCE_FLAG_STICKY) {
+                    value = !!(sticky_state[slot] & layer_mask) * program.source_scaling[i];
+                } else {
+                    if (layer_state_mask & layer_mask) {
+                        value = (flags & SOURCE_FLAG_HOLD) ? tap_hold_state[slot].hold : input_state[slot];
+                        if (flags & SOURCE_FLAG_BINARY) {
+                            value = !!value;
+                        }
+                        value *= program.source_scaling[i];
+                        if (flags & SOURCE_FLAG_FIXED_POINT) {
+                            value /= 1000;
                         }
                     }
                 }
                 if (value != 0) {
-                    if (target == V_SCROLL_USAGE || target == H_SCROLL_USAGE) {
-                        accumulated[target] += handle_scroll(map_source, target, value * RESOLUTION_MULTIPLIER, now);
+                    if (target.flags & TARGET_FLAG_SCROLL) {
+                        accumulated[target.target] += handle_scroll(i, target.target, value * RESOLUTION_MULTIPLIER, now);
                     } else {
-                        accumulated[target] += value;
+                        accumulated[target.target] += value;
                     }
                 }
             }
         } else {  // our_usage is absolute
-            int32_t value = rev_map.default_value;
-            for (auto const& map_source : rev_map.sources) {
-                if ((map_source.orig_source_port != 0) &&
-                    !(active_ports_mask & (1 << map_source.orig_source_port))) {
-                    continue;
-                }
-                if (map_source.sticky) {
-                    if (*map_source.sticky_state & map_source.layer_mask) {
-                        value += 1 * map_source.scaling / 1000 - rev_map.default_value;
+            bool register_target = target.flags & TARGET_FLAG_REGISTER;
+            int32_t default_value = target.default_value;
+            int32_t value = default_value;
+            if (all_targets_dirty || (target.flags & TARGET_FLAG_ALWAYS_DIRTY) || program.target_dirty[t]) {
+                for (uint16_t i = target.sources_begin; i < target.sources_end; i++) {
+                    uint16_t port_mask = program.source_port_mask[i];
+                    if ((port_mask != 0) && !(active_ports_mask & port_mask)) {
+                        continue;
                     }
-                } else {
-                    if ((layer_state_mask & map_source.layer_mask)) {
-                        if ((map_source.tap && map_source.tap_hold_state->tap) ||
-                            (map_source.hold && map_source.tap_hold_state->hold)) {
-                            value += 1 * map_source.scaling / 1000 - rev_map.default_value;
+                    uint8_t flags = program.source_flags[i];
+                    uint16_t slot = program.source_slot[i];
+                    uint8_t layer_mask = program.source_layer_mask[i];
+                    int32_t scaling = program.source_scaling[i];
+                    if (flags & SOURCE_FLAG_STICKY) {
+                        if (sticky_state[slot] & layer_mask) {
+                            value += 1 * scaling / 1000 - default_value;
                         }
-                        if (!map_source.tap && !map_source.hold) {
-                            if (map_source.is_relative && !register_target) {
-                                if (*map_source.input_state * map_source.scaling > 0) {
-                                    value += 1;
+                    } else if (layer_state_mask & layer_mask) {
+                        if (flags & (SOURCE_FLAG_TAP | SOURCE_FLAG_HOLD)) {
+                            if (((flags & SOURCE_FLAG_TAP) && tap_hold_state[slot].tap) ||
+                                ((flags & SOURCE_FLAG_HOLD) && tap_hold_state[slot].hold)) {
+                                value += 1 * scaling / 1000 - default_value;
+                            }
+                        } else if ((flags & SOURCE_FLAG_RELATIVE) && !register_target) {
+                            if (input_state[slot] * scaling > 0) {
+                                value += 1;
+                            }
+                        } else {
+                            int32_t candidate = input_state[slot];
+                            if ((candidate != 0) || (default_value != 0)) {
+                                if (flags & SOURCE_FLAG_BINARY) {
+                                    candidate = !!candidate;
                                 }
-                            } else {
-                                if ((*map_source.input_state != 0) || (rev_map.default_value != 0)) {
-                                    int32_t candidate = *map_source.input_state;
-                                    if (map_source.is_binary) {
-                                        candidate = !!candidate;
+                                if ((candidate != 0) || !(flags & SOURCE_FLAG_BINARY)) {
+                                    candidate = (int64_t) candidate * scaling / 1000;
+                                    if (flags & SOURCE_FLAG_FIXED_POINT) {
+                                        candidate /= 1000;
                                     }
-                                    if ((candidate != 0) || !map_source.is_binary) {
-                                        candidate = (int64_t) candidate * map_source.scaling / 1000;
-                                        if (((map_source.usage & 0xFFFF0000) == EXPR_USAGE_PAGE) ||
-                                            ((map_source.usage & 0xFFFF0000) == REGISTER_USAGE_PAGE)) {
-                                            candidate /= 1000;
-                                        }
-                                        if (candidate != rev_map.default_value) {
-                                            value += candidate - rev_map.default_value;
-                                        }
+                                    if (candidate != default_value) {
+                                        value += candidate - default_value;
                                     }
                                 }
                             }
                         }
                     }
                 }
+                // we don't currently have any absolute usages that can be negative
+                if ((value < 0) && !register_target) {
+                    value = 0;
+                }
+                if (register_target) {
+                    value *= 1000;
+                }
+                if (value != target.cached_value) {
+                    target.cached_value = value;
+                    if ((target.flags & TARGET_FLAG_IN_REPORT) && !all_targets_dirty) {
+                        update_report_images(program, target);
+                    }
+                }
+            } else {
+                value = target.cached_value;
             }
-            // we don't currently have any absolute usages that can be negative
-            if ((value < 0) && !register_target) {
-                value = 0;
-            }
-            if (register_target) {
-                value *= 1000;
-            }
-            if ((value != rev_map.default_value) || register_target) {
-                for (auto const& out_usage_def : rev_map.our_usages) {
-                    if (out_usage_def.array_count == 0) {
-                        uint32_t effective_value = value;
-                        if ((out_usage_def.size < 32) && (effective_value > ((1 << out_usage_def.size) - 1))) {
-                            effective_value = (1 << out_usage_def.size) - 1;
-                        }
-                        put_bits(out_usage_def.data, out_usage_def.len, out_usage_def.bitpos, out_usage_def.size, effective_value);
-                    } else {  // array range
-                        for (int i = 0; i < out_usage_def.array_count; i++) {
-                            int32_t existing_val = get_bits(out_usage_def.data, out_usage_def.len, out_usage_def.bitpos + i * out_usage_def.size, out_usage_def.size);
-                            // theoretically zero could be a valid index, but let's ignore that for now
-                            if (existing_val == 0) {
-                                put_bits(out_usage_def.data, out_usage_def.len, out_usage_def.bitpos + i * out_usage_def.size, out_usage_def.size, out_usage_def.array_index);
-                                break;
-                            }
-                        }
-                        // we don't do RollOver
+            if (((value != default_value) || register_target) && (target.flags & TARGET_FLAG_OUTSIDE_REPORTS)) {
+                for (uint16_t i = target.our_usages_begin; i < target.our_usages_end; i++) {
+                    if (program.our_usages[i].data != NULL) {
+                        put_usage(program.our_usages[i], value);
                     }
                 }
             }
         }
     }
 
+    if (all_targets_dirty) {
+        stale_report_images = 0xFF;
+    }
+    for (uint8_t report_id : report_ids) {
+        if (stale_report_images & (1 << report_id)) {
+            rebuild_report_image(program, report_id);
+        }
+        memcpy(reports[report_id], report_images[report_id], report_sizes[report_id]);
+    }
+    stale_report_images = 0;
+
     // execute queued macros
     if (!macro_queue.empty()) {
         for (uint32_t usage : macro_queue.front().items) {
@@ -1337,10 +1673,10 @@ void process_mapping(bool auto_repeat) {
                     if ((usage >= array_usage.usage) && (usage <= array_usage.usage_def.usage_maximum)) {
                         const uint8_t report_id = array_usage.usage_def.report_id;
                         for (unsigned int i = 0; i < array_usage.usage_def.count; i++) {
-                            int32_t existing_val = get_bits(reports[report_id], report_sizes[report_id], array_usage.usage_def.bitpos + i * array_usage.usage_def.size, array_usage.usage_def.size);
+                            int32_t existing_val = get_bits(array_usage.usage_def.bits_kernel, reports[report_id], report_sizes[report_id], array_usage.usage_def.bitpos + i * array_usage.usage_def.size, array_usage.usage_def.size);
                             // theoretically zero could be a valid index, but let's ignore that for now
                             if (existing_val == 0) {
-                                put_bits(reports[report_id], report_sizes[report_id], array_usage.usage_def.bitpos + i * array_usage.usage_def.size, array_usage.usage_def.size, array_usage.usage_def.logical_minimum + usage - array_usage.usage);
+                                put_bits(array_usage.usage_def.bits_kernel, reports[report_id], report_sizes[report_id], array_usage.usage_def.bitpos + i * array_usage.usage_def.size, array_usage.usage_def.size, array_usage.usage_def.logical_minimum + usage - array_usage.usage);
                                 break;
                             }
                         }
@@ -1353,7 +1689,7 @@ void process_mapping(bool auto_repeat) {
                     auto search = our_usages_flat.find(usage);
                     if (search != our_usages_flat.end()) {
                         const usage_def_t& our_usage = search->second;
-                        put_bits((uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size, 1);
+                        put_bits(our_usage.bits_kernel, (uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size, 1);
                     }
                 }
             }
@@ -1369,11 +1705,11 @@ void process_mapping(bool auto_repeat) {
 
     if (have_dpad) {
         uint8_t dpad_val = dpad_table[dpad_state];
-        put_bits(reports[our_dpad_usage.report_id], report_sizes[our_dpad_usage.report_id], our_dpad_usage.bitpos, our_dpad_usage.size, dpad_val);
+        put_bits(our_dpad_usage.bits_kernel, reports[our_dpad_usage.report_id], report_sizes[our_dpad_usage.report_id], our_dpad_usage.bitpos, our_dpad_usage.size, dpad_val);
     }
 
     for (auto state : relative_usages) {
-        *state = 0;
+        update_state(state, 0);
     }
 
     for (auto& [usage, accumulated_val] : accumulated) {
@@ -1382,7 +1718,7 @@ void process_mapping(bool auto_repeat) {
         }
         usage_def_t& our_usage = our_usages_flat[usage];
         // XXX I don't think this is necessary now that we only do process_mapping once per frame (existing_val is always zero)
-        int32_t existing_val = get_bits((uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size);
+        int32_t existing_val = get_bits(our_usage.bits_kernel, (uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size);
         if (our_usage.logical_minimum < 0) {
             if (existing_val & (1 << (our_usage.size - 1))) {
                 existing_val |= 0xFFFFFFFF << our_usage.size;
@@ -1391,7 +1727,7 @@ void process_mapping(bool auto_repeat) {
         int32_t truncated = accumulated_val / 1000;
         accumulated_val -= truncated * 1000;
         if (truncated != 0) {
-            put_bits((uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size, existing_val + truncated);
+            put_bits(our_usage.bits_kernel, (uint8_t*) reports[our_usage.report_id], report_sizes[our_usage.report_id], our_usage.bitpos, our_usage.size, existing_val + truncated);
         }
     }
 
@@ -1418,11 +1754,6 @@ void process_mapping(bool auto_repeat) {
                 or_items++;
             }
         }
-        if (our_descriptor->clear_report != nullptr) {
-            our_descriptor->clear_report(reports[report_id], report_id, report_sizes[report_id]);
-        } else {
-            memset(reports[report_id], 0, report_sizes[report_id]);
-        }
     }
 
     for (auto const [interface_report_id, report] : out_reports) {
@@ -1434,6 +1765,8 @@ void process_mapping(bool auto_repeat) {
         memset(report, 0, out_report_sizes[interface_report_id]);
     }
 
+    all_targets_dirty = false;
+
     processing_time += get_time() - now;
 }
 
@@ -1487,7 +1820,7 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
     int32_t value = 0;
     if (their_usage.is_array) {
         for (unsigned int i = 0; i < their_usage.count; i++) {
-            uint32_t bits = get_bits(report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+            uint32_t bits = get_bits(their_usage.bits_kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
             if (((their_usage.index_mask == 0) && (bits == their_usage.index)) ||
                 (their_usage.index_mask & (1 << bits))) {
                 value = 1;
@@ -1495,7 +1828,7 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
             }
         }
     } else {
-        value = get_bits(report, len, their_usage.bitpos, their_usage.size);
+        value = get_bits(their_usage.bits_kernel, report, len, their_usage.bitpos, their_usage.size);
         if ((their_usage.logical_minimum < 0) || (their_usage.logical_maximum < 0)) {
             if (value & (1 << (their_usage.size - 1))) {
                 value |= 0xFFFFFFFF << their_usage.size;
@@ -1505,10 +1838,10 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
 
     if (their_usage.is_relative) {
         if (their_usage.input_state_0 != NULL) {
-            *(their_usage.input_state_0) += value;
+            update_state(their_usage.input_state_0, *(their_usage.input_state_0) + value);
         }
         if (their_usage.input_state_n != NULL) {
-            *(their_usage.input_state_n) = value;  // XXX does it need to be += ?
+            update_state(their_usage.input_state_n, value);  // XXX does it need to be += ?
         }
     } else {
         int32_t scaled_value;
@@ -1520,16 +1853,16 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
         if (their_usage.input_state_0 != NULL) {
             if ((their_usage.size == 1) || their_usage.is_array) {
                 if (value) {
-                    *(their_usage.input_state_0) |= 1 << interface_idx;
+                    update_state(their_usage.input_state_0, *(their_usage.input_state_0) | (1 << interface_idx));
                 } else {
-                    *(their_usage.input_state_0) &= ~(1 << interface_idx);
+                    update_state(their_usage.input_state_0, *(their_usage.input_state_0) & ~(1 << interface_idx));
                 }
             } else {
-                *(their_usage.input_state_0) = scaled_value;
+                update_state(their_usage.input_state_0, scaled_value);
             }
         }
         if (their_usage.input_state_n != NULL) {
-            *(their_usage.input_state_n) = scaled_value;
+            update_state(their_usage.input_state_n, scaled_value);
         }
     }
 }
@@ -1537,22 +1870,71 @@ inline void read_input(const uint8_t* report, int len, uint32_t source_usage, co
 inline void read_input_range(const uint8_t* report, int len, uint32_t source_usage, const usage_def_t& their_usage, uint8_t interface_idx, uint8_t hub_port) {
     // is_array and !is_relative is implied
     for (unsigned int i = 0; i < their_usage.count; i++) {
-        uint32_t bits = get_bits(report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+        uint32_t bits = get_bits(their_usage.bits_kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
         // XXX consider negative indexes
         if ((bits >= their_usage.logical_minimum) &&
             (bits <= their_usage.logical_minimum + their_usage.usage_maximum - source_usage)) {
             uint32_t actual_usage = source_usage + bits - their_usage.logical_minimum;
             int32_t* state_ptr_0 = get_state_ptr(actual_usage, 0);
             if (state_ptr_0 != NULL) {
-                *state_ptr_0 |= 1 << interface_idx;
+                update_state(state_ptr_0, *state_ptr_0 | (1 << interface_idx));
             }
             if (hub_port != HUB_PORT_NONE) {
                 int32_t* state_ptr_n = get_state_ptr(actual_usage, hub_port);
                 if (state_ptr_n != NULL) {
-                    *state_ptr_n = 1 << interface_idx;  // set the bit because in do_handle_received_report we clear it not knowing if it's "0" or "n"
+                    update_state(state_ptr_n, 1 << interface_idx);  // set the bit because in do_handle_received_report we clear it not knowing if it's "0" or "n"
+                }
+            }
+        }
+    }
+}
+
+// Same as read_input_range(), but without state lookups. If incremental is true, only the
+// states of values that appeared or disappeared since the last report are updated,
+// otherwise the caller has already cleared them.
+inline void read_input_range_dense(const uint8_t* report, int len, uint32_t source_usage, const usage_def_t& their_usage, const decode_range_t& range, uint8_t interface_idx, bool incremental) {
+    uint32_t pressed[DECODE_MAX_RANGE_SPAN / 32];
+    uint32_t nwords = (range.len + 31) / 32;
+    memset(pressed, 0, nwords * sizeof(pressed[0]));
+
+    // is_array and !is_relative is implied, logical_minimum isn't negative (see add_decode_range())
+    uint32_t logical_minimum = their_usage.logical_minimum;
+    for (unsigned int i = 0; i < their_usage.count; i++) {
+        uint32_t bits = get_bits(their_usage.bits_kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+        if ((bits >= logical_minimum) &&
+            (bits - logical_minimum <= their_usage.usage_maximum - source_usage)) {
+            uint32_t offset = bits - logical_minimum - range.first;
+            if (offset < range.len) {
+                pressed[offset / 32] |= 1 << (offset % 32);
+            }
+        }
+    }
+
+    uint32_t* prev_pressed = &decode_program.range_pressed[range.pressed_begin];
+    for (uint32_t word = 0; word < nwords; word++) {
+        uint32_t diff = incremental ? (pressed[word] ^ prev_pressed[word]) : pressed[word];
+        while (diff) {
+            uint32_t bit = __builtin_ctz(diff);
+            diff &= diff - 1;
+            int32_t* state_ptr_0 = decode_program.range_states_0[range.states_begin + word * 32 + bit];
+            int32_t* state_ptr_n = decode_program.range_states_n[range.states_begin + word * 32 + bit];
+            if (pressed[word] & (1 << bit)) {
+                if (state_ptr_0 != NULL) {
+                    update_state(state_ptr_0, *state_ptr_0 | (1 << interface_idx));
+                }
+                if (state_ptr_n != NULL) {
+                    update_state(state_ptr_n, 1 << interface_idx);
+                }
+            } else {
+                if (state_ptr_0 != NULL) {
+                    update_state(state_ptr_0, *state_ptr_0 & ~(1 << interface_idx));
+                }
+                if (state_ptr_n != NULL) {
+                    update_state(state_ptr_n, *state_ptr_n & ~(1 << interface_idx));
                 }
             }
         }
+        prev_pressed[word] = pressed[word];
     }
 }
 
@@ -1560,7 +1942,7 @@ inline void monitor_read_input(const uint8_t* report, int len, uint32_t source_u
     int32_t value = 0;
     if (their_usage.is_array) {
         for (unsigned int i = 0; i < their_usage.count; i++) {
-            uint32_t bits = get_bits(report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+            uint32_t bits = get_bits(their_usage.bits_kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
             if (((their_usage.index_mask == 0) && (bits == their_usage.index)) ||
                 (their_usage.index_mask & (1 << bits))) {
                 value = 1;
@@ -1568,7 +1950,7 @@ inline void monitor_read_input(const uint8_t* report, int len, uint32_t source_u
             }
         }
     } else {
-        value = get_bits(report, len, their_usage.bitpos, their_usage.size);
+        value = get_bits(their_usage.bits_kernel, report, len, their_usage.bitpos, their_usage.size);
         if ((their_usage.logical_minimum < 0) || (their_usage.logical_maximum < 0)) {
             if (value & (1 << (their_usage.size - 1))) {
                 value |= 0xFFFFFFFF << their_usage.size;
@@ -1602,7 +1984,7 @@ inline void monitor_read_input(const uint8_t* report, int len, uint32_t source_u
 inline void monitor_read_input_range(const uint8_t* report, int len, uint32_t source_usage, const usage_def_t& their_usage, uint8_t interface_idx, uint8_t hub_port) {
     // is_array and !is_relative is implied
     for (unsigned int i = 0; i < their_usage.count; i++) {
-        uint32_t bits = get_bits(report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
+        uint32_t bits = get_bits(their_usage.bits_kernel, report, len, their_usage.bitpos + i * their_usage.size, their_usage.size);
         // XXX consider negative indexes
         if ((bits >= their_usage.logical_minimum) &&
             (bits <= their_usage.logical_minimum + their_usage.usage_maximum - source_usage)) {
@@ -1621,16 +2003,17 @@ void handle_received_report(const uint8_t* report, int len, uint16_t interface,
     }
 }
 
-static inline bool is_rollover(const uint8_t* report, int len, uint16_t interface, uint8_t report_id) {
-    for (auto const& usage_def : rollover_usages[interface][report_id]) {
+static inline bool is_rollover(const uint8_t* report, int len, const decode_plan_t& plan) {
+    for (uint16_t j = plan.rollover_begin; j < plan.rollover_end; j++) {
+        const usage_def_t& usage_def = decode_program.rollover_usages[j];
         if (usage_def.is_array) {
             for (unsigned int i = 0; i < usage_def.count; i++) {
-                if (get_bits(report, len, usage_def.bitpos + i * usage_def.size, usage_def.size) == usage_def.index) {
+                if (get_bits(usage_def.bits_kernel, report, len, usage_def.bitpos + i * usage_def.size, usage_def.size) == usage_def.index) {
                     return true;
                 }
             }
         } else {
-            if (get_bits(report, len, usage_def.bitpos, usage_def.size) != 0) {
+            if (get_bits(usage_def.bits_kernel, report, len, usage_def.bitpos, usage_def.size) != 0) {
                 return true;
             }
         }
@@ -1639,6 +2022,29 @@ static inline bool is_rollover(const uint8_t* report, int len, uint16_t interfac
     return false;
 }
 
+// Returns a mask of report bytes that differ from the last report we decoded
+// using this plan (all ones if we can't tell) and remembers the new report.
+static inline uint64_t changed_report_bytes(decode_plan_t& plan, uint8_t* last_report, const uint8_t* report, int len) {
+    if ((len > DECODE_MAX_REPORT_SIZE) || (len != plan.last_report_len)) {
+        if (len <= DECODE_MAX_REPORT_SIZE) {
+            memcpy(last_report, report, len);
+            plan.last_report_len = len;
+        } else {
+            plan.last_report_len = 0;
+        }
+        return UINT64_MAX;
+    }
+
+    uint64_t changed = 0;
+    for (int i = 0; i < len; i++) {
+        if (report[i] != last_report[i]) {
+            changed |= (uint64_t) 1 << i;
+            last_report[i] = report[i];
+        }
+    }
+    return changed;
+}
+
 void do_handle_received_report(const uint8_t* report, int len, uint16_t interface, uint8_t external_report_id) {
     if (len == 0) {
         return;
@@ -1648,8 +2054,16 @@ void do_handle_received_report(const uint8_t* report, int len, uint16_t interfac
 
     my_mutex_enter(MutexId::THEIR_USAGES);
 
+    const decode_interface_t* decode_interface = NULL;
+    for (auto const& itf : decode_program.interfaces) {
+        if (itf.interface == interface) {
+            decode_interface = &itf;
+            break;
+        }
+    }
+
     uint8_t report_id = 0;
-    if (has_report_id_theirs[interface]) {
+    if ((decode_interface != NULL) ? decode_interface->has_report_id : has_report_id_theirs[interface]) {
         if (external_report_id != 0) {
             report_id = external_report_id;
         } else {
@@ -1659,20 +2073,42 @@ void do_handle_received_report(const uint8_t* report, int len, uint16_t interfac
         }
     }
 
-    uint8_t interface_idx = interface_index[interface];
+    uint8_t interface_idx = (decode_interface != NULL) ? decode_interface->interface_idx : interface_index[interface];
     uint8_t hub_port = hub_ports[interface >> 8];
     if (hub_port != HUB_PORT_NONE) {
         active_ports_mask |= 1 << hub_port;
     }
 
-    if (!is_rollover(report, len, interface, report_id)) {
-        for (int32_t* state_ptr : array_range_usages[interface][report_id]) {
-            *state_ptr &= ~(1 << interface_idx);
+    uint16_t plan_idx = (decode_interface != NULL) ? decode_interface->plans[report_id] : DECODE_PLAN_NONE;
+    if ((plan_idx != DECODE_PLAN_NONE) && !is_rollover(report, len, decode_program.plans[plan_idx])) {
+        decode_plan_t& plan = decode_program.plans[plan_idx];
+        // Usages whose bytes didn't change would decode to the same state, so we skip them
+        // (unless something else could have changed that state, see compile_decode_program()).
+        uint64_t changed = changed_report_bytes(plan, &decode_program.last_reports[plan_idx * DECODE_MAX_REPORT_SIZE], report, len);
+
+        bool use_range_tables = (hub_port == decode_interface->hub_port);
+        bool ranges_incremental = plan.range_pressed_valid && use_range_tables;
+        if (!plan.array_ranges_skippable || (plan.array_range_byte_mask & changed)) {
+            if (!ranges_incremental) {
+                for (uint16_t j = plan.array_range_states_begin; j < plan.array_range_states_end; j++) {
+                    int32_t* state_ptr = decode_program.array_range_states[j];
+                    update_state(state_ptr, *state_ptr & ~(1 << interface_idx));
+                }
+            }
+            plan.range_pressed_valid = plan.array_ranges_incremental && use_range_tables;
         }
 
-        for (auto const& their : their_used_usages[interface][report_id]) {
+        for (uint16_t j = plan.reads_begin; j < plan.reads_end; j++) {
+            const usage_usage_def_t& their = decode_program.reads[j];
+            if (decode_program.reads_skippable[j] && !(decode_program.reads_byte_mask[j] & changed)) {
+                report_bytes_skipped += decode_program.reads_nbytes[j];
+                continue;
+            }
+            report_bytes_decoded += decode_program.reads_nbytes[j];
             if (their.usage_def.usage_maximum == 0) {
                 read_input(report, len, their.usage, their.usage_def, interface_idx);
+            } else if (use_range_tables && (decode_program.reads_range[j] != DECODE_RANGE_NONE)) {
+                read_input_range_dense(report, len, their.usage, their.usage_def, decode_program.ranges[decode_program.reads_range[j]], interface_idx, ranges_incremental);
             } else {
                 read_input_range(report, len, their.usage, their.usage_def, interface_idx, hub_port);
             }
@@ -1744,11 +2180,11 @@ void handle_received_midi(uint8_t hub_port, uint8_t* midi_msg) {
 void set_input_state(uint32_t usage, int32_t state_raw, int32_t state_scaled, uint8_t hub_port) {
     int32_t* state_ptr = get_state_ptr(usage, hub_port, false, true);
     if (state_ptr != NULL) {
-        *state_ptr = state_raw;
+        update_state(state_ptr, state_raw);
     }
     state_ptr = get_state_ptr(usage, hub_port, false, false);
     if (state_ptr != NULL) {
-        *state_ptr = state_scaled;
+        update_state(state_ptr, state_scaled);
     }
 }
 
@@ -1792,21 +2228,421 @@ bool should_scale_input(const usage_def_t& their_usage) {
     return true;
 }
 
+// Flattens reverse_mapping into mapping_program. Everything that only depends
+// on the configuration (usage pages, flags, hub ports) is resolved here so that
+// the per-frame loop in process_mapping() only has to look at flag bits.
+void compile_mapping_program() {
+    mapping_program_t& program = mapping_program;
+
+    program.targets.clear();
+    program.source_slot.clear();
+    program.source_scaling.clear();
+    program.source_layer_mask.clear();
+    program.source_flags.clear();
+    program.source_port_mask.clear();
+    program.source_accumulated_scroll.clear();
+    program.source_last_scroll_timestamp.clear();
+    program.our_usages.clear();
+    program.target_dirty.clear();
+    program.slot_targets_begin.assign(used_state_slots + 2, 0);
+    program.slot_targets.clear();
+
+    for (auto const& rev_map : reverse_mapping) {
+        mapping_target_t target = {
+            .target = rev_map.target,
+            .sources_begin = (uint16_t) program.source_slot.size(),
+            .our_usages_begin = (uint16_t) program.our_usages.size(),
+            .default_value = rev_map.default_value,
+            .flags = 0,
+            .cached_value = 0,
+        };
+        if (rev_map.is_relative) {
+            target.flags |= TARGET_FLAG_RELATIVE;
+        }
+        if ((rev_map.target & 0xFFFF0000) == REGISTER_USAGE_PAGE) {
+            target.flags |= TARGET_FLAG_REGISTER;
+        }
+        if ((rev_map.target == V_SCROLL_USAGE) || (rev_map.target == H_SCROLL_USAGE)) {
+            target.flags |= TARGET_FLAG_SCROLL;
+        }
+
+        for (auto const& map_source : rev_map.sources) {
+            uint8_t flags = 0;
+            if (map_source.sticky) {
+                flags |= SOURCE_FLAG_STICKY;
+            }
+            if (map_source.tap) {
+                flags |= SOURCE_FLAG_TAP;
+            }
+            if (map_source.hold) {
+                flags |= SOURCE_FLAG_HOLD;
+            }
+            if (map_source.tap || map_source.hold) {
+                target.flags |= TARGET_FLAG_ALWAYS_DIRTY;
+            }
+            if (map_source.is_relative) {
+                flags |= SOURCE_FLAG_RELATIVE;
+            }
+            if (map_source.is_binary) {
+                flags |= SOURCE_FLAG_BINARY;
+            }
+            if (((map_source.usage & 0xFFFF0000) == EXPR_USAGE_PAGE) ||
+                ((map_source.usage & 0xFFFF0000) == REGISTER_USAGE_PAGE)) {
+                flags |= SOURCE_FLAG_FIXED_POINT;
+            }
+            program.source_slot.push_back(map_source.input_state - input_state);
+            program.source_scaling.push_back(map_source.scaling);
+            program.source_layer_mask.push_back(map_source.layer_mask);
+            program.source_flags.push_back(flags);
+            program.source_port_mask.push_back((map_source.orig_source_port != 0) ? (1 << map_source.orig_source_port) : 0);
+            program.source_accumulated_scroll.push_back(0);
+            program.source_last_scroll_timestamp.push_back(0);
+        }
+
+        for (auto const& out_usage_def : rev_map.our_usages) {
+            program.our_usages.push_back(out_usage_def);
+            program.our_usages.back().bits_kernel = pick_bits_kernel(out_usage_def.bitpos, out_usage_def.size, out_usage_def.array_count);
+            target.flags |= (out_usage_def.data == NULL) ? TARGET_FLAG_IN_REPORT : TARGET_FLAG_OUTSIDE_REPORTS;
+        }
+
+        target.sources_end = program.source_slot.size();
+        target.our_usages_end = program.our_usages.size();
+        program.targets.push_back(target);
+        program.target_dirty.push_back(1);
+    }
+
+    // slot -> dependent absolute targets, grouped by slot
+    for (auto const& target : program.targets) {
+        for (uint16_t i = target.sources_begin; i < target.sources_end; i++) {
+            program.slot_targets_begin[program.source_slot[i] + 2]++;
+        }
+    }
+    for (uint32_t slot = 2; slot < program.slot_targets_begin.size(); slot++) {
+        program.slot_targets_begin[slot] += program.slot_targets_begin[slot - 1];
+    }
+    program.slot_targets.resize(program.source_slot.size());
+    for (uint16_t t = 0; t < program.targets.size(); t++) {
+        for (uint16_t i = program.targets[t].sources_begin; i < program.targets[t].sources_end; i++) {
+            program.slot_targets[program.slot_targets_begin[program.source_slot[i] + 1]++] = t;
+        }
+    }
+
+    // usages in our input reports, by report ID, in target order (that's the order
+    // they get put in, which matters where they overlap)
+    program.image_usages_begin.assign(MAX_INPUT_REPORT_ID + 2, 0);
+    program.image_usages.clear();
+    program.image_usage_targets.clear();
+    for (uint8_t report_id = 0; report_id <= MAX_INPUT_REPORT_ID; report_id++) {
+        program.image_usages_begin[report_id] = program.image_usages.size();
+        for (uint16_t t = 0; t < program.targets.size(); t++) {
+            if (program.targets[t].flags & TARGET_FLAG_RELATIVE) {
+                continue;
+            }
+            for (uint16_t i = program.targets[t].our_usages_begin; i < program.targets[t].our_usages_end; i++) {
+                if ((program.our_usages[i].data == NULL) && (program.our_usages[i].report_id == report_id)) {
+                    program.image_usages.push_back(i);
+                    program.image_usage_targets.push_back(t);
+                }
+            }
+        }
+    }
+    program.image_usages_begin[MAX_INPUT_REPORT_ID + 1] = program.image_usages.size();
+
+    // find usages that share bits with another one
+    std::vector<uint16_t> by_position(program.image_usages);
+    std::sort(by_position.begin(), by_position.end(),
+        [&program](uint16_t a, uint16_t b) {
+            const out_usage_def_t& usage_a = program.our_usages[a];
+            const out_usage_def_t& usage_b = program.our_usages[b];
+            return (usage_a.report_id < usage_b.report_id) ||
+                   ((usage_a.report_id == usage_b.report_id) && (usage_a.bitpos < usage_b.bitpos));
+        });
+    auto usage_end = [&program](uint16_t i) {
+        const out_usage_def_t& out_usage_def = program.our_usages[i];
+        return out_usage_def.bitpos + out_usage_def.size * std::max(out_usage_def.array_count, (uint8_t) 1);
+    };
+    std::vector<bool> overlapping(program.our_usages.size(), false);
+    uint32_t max_end = 0;
+    for (uint32_t k = 0; k < by_position.size(); k++) {
+        const out_usage_def_t& out_usage_def = program.our_usages[by_position[k]];
+        if ((k > 0) && (program.our_usages[by_position[k - 1]].report_id != out_usage_def.report_id)) {
+            max_end = 0;
+        }
+        if (out_usage_def.bitpos < max_end) {
+            overlapping[by_position[k]] = true;
+        }
+        if ((k + 1 < by_position.size()) &&
+            (program.our_usages[by_position[k + 1]].report_id == out_usage_def.report_id) &&
+            (program.our_usages[by_position[k + 1]].bitpos < usage_end(by_position[k]))) {
+            overlapping[by_position[k]] = true;
+        }
+        max_end = std::max(max_end, (uint32_t) usage_end(by_position[k]));
+    }
+
+    for (auto& target : program.targets) {
+        if (!(target.flags & TARGET_FLAG_IN_REPORT) || (target.flags & TARGET_FLAG_RELATIVE)) {
+            continue;
+        }
+        target.flags |= TARGET_FLAG_EXCLUSIVE;
+        for (uint16_t i = target.our_usages_begin; i < target.our_usages_end; i++) {
+            if ((program.our_usages[i].data == NULL) &&
+                ((program.our_usages[i].array_count != 0) || overlapping[i])) {
+                target.flags &= ~TARGET_FLAG_EXCLUSIVE;
+            }
+        }
+    }
+
+    all_targets_dirty = true;
+}
+
+// Builds the dense state table for the array range read that was just added to decode_program.
+void add_decode_range(uint32_t usage, const usage_def_t& usage_def, uint8_t hub_port) {
+    decode_program_t& program = decode_program;
+
+    // arrays with negative indexes keep going through read_input_range()
+    if (usage_def.logical_minimum < 0) {
+        return;
+    }
+
+    uint32_t first = UINT32_MAX;
+    uint32_t last = 0;
+    for (uint32_t actual_usage = usage; actual_usage <= usage_def.usage_maximum; actual_usage++) {
+        if ((get_state_ptr(actual_usage, 0) != NULL) ||
+            ((hub_port != HUB_PORT_NONE) && (get_state_ptr(actual_usage, hub_port) != NULL))) {
+            if (first == UINT32_MAX) {
+                first = actual_usage - usage;
+            }
+            last = actual_usage - usage;
+        }
+        if (actual_usage == UINT32_MAX) {
+            break;
+        }
+    }
+    if ((first == UINT32_MAX) || (last - first + 1 > DECODE_MAX_RANGE_SPAN)) {
+        return;
+    }
+
+    decode_range_t range = {
+        .first = first,
+        .len = (uint16_t) (last - first + 1),
+        .states_begin = (uint32_t) program.range_states_0.size(),
+        .pressed_begin = (uint32_t) program.range_pressed.size(),
+    };
+    for (uint32_t offset = first; offset <= last; offset++) {
+        program.range_states_0.push_back(get_state_ptr(usage + offset, 0));
+        program.range_states_n.push_back((hub_port != HUB_PORT_NONE) ? get_state_ptr(usage + offset, hub_port) : NULL);
+    }
+    program.range_pressed.resize(program.range_pressed.size() + (range.len + 31) / 32, 0);
+    program.reads_range.back() = program.ranges.size();
+    program.ranges.push_back(range);
+}
+
+static uint32_t usage_nbytes(const usage_def_t& usage_def) {
+    uint32_t nbits = usage_def.size * (usage_def.is_array ? usage_def.count : 1);
+    uint32_t first_byte = usage_def.bitpos / 8;
+    uint32_t last_byte = (nbits > 0) ? (usage_def.bitpos + nbits - 1) / 8 : first_byte;
+    return last_byte - first_byte + 1;
+}
+
+// bit n set if the usage's value is (partly) in byte n of the report. Usages that
+// reach past the bytes changed_report_bytes() keeps track of get all bits set, so
+// they're read whenever anything changed (which is always, for long reports).
+static uint64_t usage_byte_mask(const usage_def_t& usage_def) {
+    uint32_t first_byte = usage_def.bitpos / 8;
+    if (first_byte + usage_nbytes(usage_def) > DECODE_MAX_REPORT_SIZE) {
+        return UINT64_MAX;
+    }
+    uint64_t byte_mask = 0;
+    for (uint32_t byte_no = first_byte; byte_no < first_byte + usage_nbytes(usage_def); byte_no++) {
+        byte_mask |= (uint64_t) 1 << byte_no;
+    }
+    return byte_mask;
+}
+
+void compile_decode_program(
+    std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<usage_usage_def_t>>>& their_used_usages,
+    std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<int32_t*>>>& array_range_usages,
+    std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<usage_def_t>>>& rollover_usages) {
+    decode_program_t& program = decode_program;
+
+    program.interfaces.clear();
+    program.plans.clear();
+    program.rollover_usages.clear();
+    program.array_range_states.clear();
+    program.reads.clear();
+    program.reads_byte_mask.clear();
+    program.reads_nbytes.clear();
+    program.reads_skippable.clear();
+    program.reads_range.clear();
+    program.ranges.clear();
+    program.range_states_0.clear();
+    program.range_states_n.clear();
+    program.range_pressed.clear();
+
+    for (auto const& [interface, report_id_usage_map] : their_usages) {
+        decode_interface_t decode_interface = {
+            .interface = interface,
+        };
+        auto has_report_id_search = has_report_id_theirs.find(interface);
+        decode_interface.has_report_id = (has_report_id_search != has_report_id_theirs.end()) && has_report_id_search->second;
+        auto interface_index_search = interface_index.find(interface);
+        decode_interface.interface_idx = (interface_index_search != interface_index.end()) ? interface_index_search->second : 0;
+        decode_interface.hub_port = hub_ports[interface >> 8];
+        for (unsigned int report_id = 0; report_id < 256; report_id++) {
+            decode_interface.plans[report_id] = DECODE_PLAN_NONE;
+        }
+
+        for (auto const& [report_id, usage_map] : report_id_usage_map) {
+            decode_plan_t plan;
+            plan.rollover_begin = program.rollover_usages.size();
+            plan.array_range_states_begin = program.array_range_states.size();
+            plan.reads_begin = program.reads.size();
+            // these are locals of update_their_descriptor_derivates(), so it's fine if [] adds empty entries
+            for (auto const& usage_def : rollover_usages[interface][report_id]) {
+                program.rollover_usages.push_back(usage_def);
+            }
+            for (int32_t* state_ptr : array_range_usages[interface][report_id]) {
+                program.array_range_states.push_back(state_ptr);
+            }
+            plan.array_range_byte_mask = 0;
+            for (auto const& their : their_used_usages[interface][report_id]) {
+                program.reads.push_back(their);
+                const usage_def_t& usage_def = their.usage_def;
+                uint64_t byte_mask = usage_byte_mask(usage_def);
+                program.reads_byte_mask.push_back(byte_mask);
+                program.reads_nbytes.push_back(usage_nbytes(usage_def));
+                program.reads_skippable.push_back(!usage_def.is_relative);
+                program.reads_range.push_back(DECODE_RANGE_NONE);
+                if (usage_def.usage_maximum != 0) {
+                    plan.array_range_byte_mask |= byte_mask;
+                    add_decode_range(their.usage, usage_def, decode_interface.hub_port);
+                }
+            }
+            // array range usages are cleared together, so any change to one means all of them have to be read again
+            for (uint16_t j = plan.reads_begin; j < program.reads.size(); j++) {
+                if (program.reads[j].usage_def.usage_maximum != 0) {
+                    program.reads_byte_mask[j] = plan.array_range_byte_mask;
+                }
+            }
+            plan.array_ranges_skippable = true;
+            plan.array_ranges_incremental = true;
+            plan.range_pressed_valid = false;
+            plan.rollover_end = program.rollover_usages.size();
+            plan.array_range_states_end = program.array_range_states.size();
+            plan.reads_end = program.reads.size();
+            plan.last_report_len = 0;
+            if ((plan.rollover_end != plan.rollover_begin) ||
+                (plan.array_range_states_end != plan.array_range_states_begin) ||
+                (plan.reads_end != plan.reads_begin)) {
+                decode_interface.plans[report_id] = program.plans.size();
+                program.plans.push_back(plan);
+            }
+        }
+
+        program.interfaces.push_back(decode_interface);
+    }
+
+    // Skipping a read is only correct if nothing else writes to its input_state slots
+    // in the meantime. Other interfaces setting their own bits of a binary usage are fine.
+    // Slots of relative usages are reset every frame. Array range usages of a report
+    // are cleared and read as a group (writer 0x10000 + plan index).
+    auto for_each_write = [&program](uint16_t plan_idx, uint8_t interface_idx, auto&& fn) {
+        const decode_plan_t& plan = program.plans[plan_idx];
+        for (uint16_t j = plan.reads_begin; j < plan.reads_end; j++) {
+            const usage_def_t& usage_def = program.reads[j].usage_def;
+            if (usage_def.usage_maximum == 0) {
+                bool bitwise = !usage_def.is_relative && ((usage_def.size == 1) || usage_def.is_array);
+                if (usage_def.input_state_0 != NULL) {
+                    fn(j, usage_def.input_state_0, bitwise ? interface_idx : -1);
+                }
+                if (usage_def.input_state_n != NULL) {
+                    fn(j, usage_def.input_state_n, -1);
+                }
+            }
+        }
+        for (uint16_t j = plan.array_range_states_begin; j < plan.array_range_states_end; j++) {
+            fn(0x10000 + plan_idx, program.array_range_states[j], -1);
+        }
+    };
+
+    std::unordered_map<int32_t*, std::vector<std::pair<uint32_t, int8_t>>> writers;  // input_state ptr -> (writer, interface bit or -1)
+    for (auto const& decode_interface : program.interfaces) {
+        for (unsigned int report_id = 0; report_id < 256; report_id++) {
+            if (decode_interface.plans[report_id] != DECODE_PLAN_NONE) {
+                for_each_write(decode_interface.plans[report_id], decode_interface.interface_idx,
+                    [&writers](uint32_t writer, int32_t* state_ptr, int8_t bit) {
+                        writers[state_ptr].push_back({ writer, bit });
+                    });
+            }
+        }
+    }
+
+    std::unordered_set<int32_t*> relative_usage_set(relative_usages.begin(), relative_usages.end());
+    for (auto const& decode_interface : program.interfaces) {
+        for (unsigned int report_id = 0; report_id < 256; report_id++) {
+            uint16_t plan_idx = decode_interface.plans[report_id];
+            if (plan_idx == DECODE_PLAN_NONE) {
+                continue;
+            }
+            decode_plan_t& plan = program.plans[plan_idx];
+            for_each_write(plan_idx, decode_interface.interface_idx,
+                [&](uint32_t writer, int32_t* state_ptr, int8_t bit) {
+                    bool exclusive = (relative_usage_set.count(state_ptr) == 0);
+                    for (auto const& [other_writer, other_bit] : writers[state_ptr]) {
+                        if ((other_writer != writer) && ((bit < 0) || (other_bit < 0) || (bit == other_bit))) {
+                            exclusive = false;
+                        }
+                    }
+                    if (!exclusive) {
+                        if (writer >= 0x10000) {
+                            plan.array_ranges_skippable = false;
+                        } else {
+                            program.reads_skippable[writer] = false;
+                        }
+                    }
+                });
+            for (uint16_t j = plan.reads_begin; j < plan.reads_end; j++) {
+                if (program.reads[j].usage_def.usage_maximum != 0) {
+                    program.reads_skippable[j] = plan.array_ranges_skippable;
+                }
+            }
+
+            // Updating only the values that changed requires that the states are ours alone,
+            // that all ranges have tables and that no state shows up in two ranges.
+            plan.array_ranges_incremental = plan.array_ranges_skippable;
+            for (uint16_t j = plan.reads_begin; j < plan.reads_end; j++) {
+                if ((program.reads[j].usage_def.usage_maximum != 0) && (program.reads_range[j] == DECODE_RANGE_NONE)) {
+                    plan.array_ranges_incremental = false;
+                }
+            }
+            std::unordered_set<int32_t*> range_states;
+            for (uint16_t j = plan.array_range_states_begin; j < plan.array_range_states_end; j++) {
+                if (!range_states.insert(program.array_range_states[j]).second) {
+                    plan.array_ranges_incremental = false;
+                }
+            }
+        }
+    }
+
+    program.last_reports.assign(program.plans.size() * DECODE_MAX_REPORT_SIZE, 0);
+}
+
 void update_their_descriptor_derivates() {
     std::unordered_set<int32_t*> relative_usage_set;
     std::unordered_set<int32_t*> binary_usage_set;
     std::set<uint64_t> their_usage_ranges_set;
+    std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<usage_usage_def_t>>> their_used_usages;  // dev_addr+interface -> report_id -> (usage, usage_def) vector
+    std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<int32_t*>>> array_range_usages;          // dev_addr+interface -> report_id -> input_state ptr vector
+    std::unordered_map<uint16_t, std::unordered_map<uint8_t, std::vector<usage_def_t>>> rollover_usages;          // dev_addr+interface -> report_id -> usage_def vector
 
     relative_usages.clear();
-    their_used_usages.clear();
-    array_range_usages.clear();
-    rollover_usages.clear();
 
     for (auto& [interface, report_id_usage_map] : their_usages) {
         uint8_t hub_port = hub_ports[interface >> 8];
         for (auto& [report_id, usage_map] : report_id_usage_map) {
             for (auto [usage, usage_def] : usage_map) {
                 usage_def.should_be_scaled = should_scale_input(usage_def);
+                usage_def.bits_kernel = pick_bits_kernel(usage_def.bitpos, usage_def.size, usage_def.count);
                 if (usage_def.usage_maximum == 0) {
                     int32_t* state_ptr_0 = get_state_ptr(usage, 0);
                     int32_t* state_ptr_n = get_state_ptr(usage, hub_port);
@@ -1884,6 +2720,7 @@ void update_their_descriptor_derivates() {
                                 .is_array = true,
                                 .index = usage_def.logical_minimum + actual_usage - usage,
                                 .count = usage_def.count,
+                                .bits_kernel = usage_def.bits_kernel,
                             });
                         }
                     }
@@ -1941,6 +2778,10 @@ void update_their_descriptor_derivates() {
                 });
         }
     }
+
+    compile_decode_program(their_used_usages, array_range_usages, rollover_usages);
+    rebuild_state_table();
+    compile_mapping_program();
 }
 
 void parse_our_descriptor() {
@@ -1988,12 +2829,20 @@ void parse_our_descriptor() {
         report_masks_absolute[report_id] = new uint8_t[size];
         memset(report_masks_absolute[report_id], 0, size);
 
+        memset(report_templates[report_id], 0, sizeof(report_templates[report_id]));
+        if (our_descriptor->clear_report != nullptr) {
+            our_descriptor->clear_report(report_templates[report_id], report_id, report_sizes[report_id]);
+        }
+        memcpy(report_images[report_id], report_templates[report_id], sizeof(report_images[report_id]));
+
         report_ids.push_back(report_id);
     }
+    stale_report_images = 0xFF;
 
     std::set<uint64_t> our_usage_ranges_set;
-    for (auto const& [report_id, usage_map] : our_usages) {
-        for (auto const& [usage, usage_def] : usage_map) {
+    for (auto& [report_id, usage_map] : our_usages) {
+        for (auto& [usage, usage_def] : usage_map) {
+            usage_def.bits_kernel = pick_bits_kernel(usage_def.bitpos, usage_def.size, usage_def.count);
             if (usage_def.usage_maximum == 0) {
                 our_usages_flat[usage] = usage_def;
                 if (usage == DPAD_USAGE) {
@@ -2026,10 +2875,12 @@ void parse_our_descriptor() {
 }
 
 void print_stats() {
-    printf("%lu %lu %lu\n", reports_received, reports_sent, processing_time);
+    printf("%lu %lu %lu %lu %lu\n", reports_received, reports_sent, processing_time, report_bytes_decoded, report_bytes_skipped);
     reports_received = 0;
     reports_sent = 0;
     processing_time = 0;
+    report_bytes_decoded = 0;
+    report_bytes_skipped = 0;
 }
 
 void reset_state() {
@@ -34,6 +34,15 @@ enum class ConfigCommand : int8_t {
     GET_QUIRK = 25,
 };
 
+// how a bit field is read and written, see pick_bits_kernel()
+enum class BitsKernel : uint8_t {
+    GENERIC = 0,
+    ALIGNED_8 = 1,
+    ALIGNED_16 = 2,
+    ALIGNED_32 = 3,
+    WINDOW = 4,  // not byte-aligned, but fits in four bytes
+};
+
 struct usage_def_t {
     uint8_t report_id;
     uint8_t size;
@@ -49,6 +58,7 @@ struct usage_def_t {
     int32_t* input_state_0 = NULL;
     int32_t* input_state_n = NULL;
     uint8_t index_mask = 0;
+    BitsKernel bits_kernel = BitsKernel::GENERIC;
 };
 
 struct usage_usage_def_t {
@@ -143,8 +153,6 @@ struct map_source_t {
     int32_t* input_state;
     tap_hold_state_t* tap_hold_state;
     uint8_t* sticky_state;
-    int32_t accumulated_scroll;
-    uint64_t last_scroll_timestamp;  // XXX we can make this 32 or less bits
 };
 
 struct out_usage_def_t {
@@ -154,6 +162,8 @@ struct out_usage_def_t {
     uint16_t bitpos;
     uint8_t array_count;
     uint32_t array_index;
+    BitsKernel bits_kernel = BitsKernel::GENERIC;
+    uint8_t report_id = 0;  // if data is NULL, the target is in our input report report_id
 };
 
 struct reverse_mapping_t {
@@ -165,6 +175,94 @@ struct reverse_mapping_t {
     std::vector<map_source_t> sources;
 };
 
+struct mapping_target_t {
+    uint32_t target;
+    uint16_t sources_begin;
+    uint16_t sources_end;
+    uint16_t our_usages_begin;
+    uint16_t our_usages_end;
+    uint8_t default_value;
+    uint8_t flags;
+    int32_t cached_value;  // result of the last evaluation, for absolute targets
+};
+
+#define DECODE_PLAN_NONE 0xFFFF
+#define DECODE_MAX_REPORT_SIZE 64  // reports longer than this are always decoded in full
+#define DECODE_RANGE_NONE 0xFFFF
+#define DECODE_MAX_RANGE_SPAN 1024
+
+// What to do with a received input report. Ranges index the arrays in decode_program_t.
+struct decode_plan_t {
+    uint16_t rollover_begin;
+    uint16_t rollover_end;
+    uint16_t array_range_states_begin;
+    uint16_t array_range_states_end;
+    uint16_t reads_begin;
+    uint16_t reads_end;
+    uint64_t array_range_byte_mask;  // report bytes covered by array range usages
+    bool array_ranges_skippable;
+    bool array_ranges_incremental;  // array range state only changes when range_pressed does
+    bool range_pressed_valid;
+    uint8_t last_report_len;  // zero if there's no previous report to compare against
+};
+
+// Dense lookup for an array range usage, indexed by (value - logical_minimum - first).
+// Only covers the span of values that are actually mapped.
+struct decode_range_t {
+    uint32_t first;
+    uint16_t len;
+    uint32_t states_begin;   // index into range_states_0 and range_states_n
+    uint32_t pressed_begin;  // index into range_pressed, (len + 31) / 32 words
+};
+
+struct decode_interface_t {
+    uint16_t interface;  // dev_addr+interface
+    bool has_report_id;
+    uint8_t interface_idx;
+    uint8_t hub_port;  // the range tables were built for this hub port
+    uint16_t plans[256];  // report_id -> plan index or DECODE_PLAN_NONE
+};
+
+// their_used_usages and friends flattened by update_their_descriptor_derivates()
+// so that do_handle_received_report() doesn't have to do any map lookups.
+struct decode_program_t {
+    std::vector<decode_interface_t> interfaces;
+    std::vector<decode_plan_t> plans;
+    std::vector<usage_def_t> rollover_usages;
+    std::vector<int32_t*> array_range_states;
+    std::vector<usage_usage_def_t> reads;
+    std::vector<uint64_t> reads_byte_mask;  // bit n set if the read looks at byte n of the report
+    std::vector<uint8_t> reads_nbytes;
+    std::vector<uint8_t> reads_skippable;  // can be skipped if none of its bytes changed
+    std::vector<uint16_t> reads_range;     // index into ranges or DECODE_RANGE_NONE
+    std::vector<decode_range_t> ranges;
+    std::vector<int32_t*> range_states_0;
+    std::vector<int32_t*> range_states_n;
+    std::vector<uint32_t> range_pressed;  // values present in the last decoded report
+    std::vector<uint8_t> last_reports;  // DECODE_MAX_REPORT_SIZE bytes per plan
+};
+
+// reverse_mapping compiled into a flat form that process_mapping() can walk
+// without chasing per-mapping heap allocations. Per-source data is kept in
+// parallel arrays indexed by source number.
+struct mapping_program_t {
+    std::vector<mapping_target_t> targets;
+    std::vector<uint16_t> source_slot;  // index into input_state, tap_hold_state and sticky_state
+    std::vector<int32_t> source_scaling;
+    std::vector<uint8_t> source_layer_mask;
+    std::vector<uint8_t> source_flags;
+    std::vector<uint16_t> source_port_mask;  // zero if the source isn't tied to a hub port
+    std::vector<int32_t> source_accumulated_scroll;
+    std::vector<uint64_t> source_last_scroll_timestamp;  // XXX we can make this 32 or less bits
+    std::vector<out_usage_def_t> our_usages;
+    std::vector<uint8_t> target_dirty;
+    std::vector<uint16_t> slot_targets_begin;  // input_state slot -> range in slot_targets
+    std::vector<uint16_t> slot_targets;        // target indexes
+    std::vector<uint16_t> image_usages_begin;   // report ID -> range in image_usages
+    std::vector<uint16_t> image_usages;         // our_usages indexes that go into our input reports, in target order
+    std::vector<uint16_t> image_usage_targets;  // the target each of image_usages belongs to
+};
+
 struct tap_hold_usage_t {
     int32_t* input_state;
     tap_hold_state_t* tap_hold_state;
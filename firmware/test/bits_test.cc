@@ -0,0 +1,85 @@
+// The get_bits()/put_bits() kernels against the bit-by-bit versions, for every
+// field position and size pick_bits_kernel() can be asked about, plus a rough
+// comparison of their speed.
+
+#include <chrono>
+
+#include "../src/remapper.cc"
+
+#include "scenario.h"
+#include "test.h"
+
+static const char* kernel_names[] = { "GENERIC", "ALIGNED_8", "ALIGNED_16", "ALIGNED_32", "WINDOW" };
+
+static void check_field(BitsKernel kernel, uint16_t bitpos, uint8_t size, int len) {
+    uint8_t data[20];
+    uint8_t expected[20];
+    for (unsigned int i = 0; i < sizeof(data); i++) {
+        data[i] = expected[i] = scenario_rand();
+    }
+    CHECK_EQ(get_bits(kernel, data, len, bitpos, size), get_bits(data, len, bitpos, size));
+
+    uint32_t value = scenario_rand() ^ (scenario_rand() << 24);
+    put_bits(kernel, data, len, bitpos, size, value);
+    put_bits(expected, len, bitpos, size, value);
+    if (memcmp(data, expected, sizeof(data))) {
+        printf("put_bits(%s, len=%d, bitpos=%d, size=%d) differs\n", kernel_names[(uint8_t) kernel], len, bitpos, size);
+        test_failures++;
+    }
+}
+
+static void benchmark(BitsKernel kernel, uint16_t bitpos, uint8_t size) {
+    const uint32_t iterations = 5000000;
+    alignas(4) uint8_t data[16] = { 0 };
+    uint32_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        put_bits(kernel, data, sizeof(data), bitpos, size, i);
+        sum += get_bits(kernel, data, sizeof(data), bitpos, size);
+        asm volatile("" : : "r"(data) : "memory");
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iterations; i++) {
+        put_bits(data, sizeof(data), bitpos, size, i);
+        sum += get_bits(data, sizeof(data), bitpos, size);
+        asm volatile("" : : "r"(data) : "memory");
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("%-10s bitpos %2d size %2d: %5lld us, bit by bit %6lld us (%u)\n", kernel_names[(uint8_t) kernel], bitpos, size,
+        (long long) std::chrono::duration_cast<std::chrono::microseconds>(middle - start).count(),
+        (long long) std::chrono::duration_cast<std::chrono::microseconds>(end - middle).count(), sum);
+}
+
+int main() {
+    uint32_t picked[5] = { 0 };
+    for (uint32_t count : { 0, 1, 2, 6 }) {
+        for (uint16_t bitpos = 0; bitpos < 64; bitpos++) {
+            for (uint8_t size = 1; size <= 32; size++) {
+                BitsKernel kernel = pick_bits_kernel(bitpos, size, count);
+                picked[(uint8_t) kernel]++;
+                for (uint32_t i = 0; i < std::max(count, (uint32_t) 1); i++) {
+                    // fields that fit and fields that stick out past the end of the report
+                    for (int len : { 20, 16, 12, 9, 8, 5 }) {
+                        check_field(kernel, bitpos + i * size, size, len);
+                    }
+                }
+                if (test_failures >= FAILURE_LIMIT) {
+                    return test_result("bits_test");
+                }
+            }
+        }
+    }
+    for (int k = 0; k < 5; k++) {
+        printf("%s picked for %u fields\n", kernel_names[k], picked[k]);
+        CHECK(picked[k] > 0);
+    }
+
+    benchmark(BitsKernel::ALIGNED_8, 8, 8);
+    benchmark(BitsKernel::ALIGNED_16, 16, 16);
+    benchmark(BitsKernel::ALIGNED_32, 32, 32);
+    benchmark(BitsKernel::WINDOW, 3, 1);
+    benchmark(BitsKernel::WINDOW, 12, 10);
+    benchmark(BitsKernel::WINDOW, 4, 4);
+
+    return test_result("bits_test");
+}
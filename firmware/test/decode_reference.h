@@ -0,0 +1,101 @@
+#ifndef _DECODE_REFERENCE_H_
+#define _DECODE_REFERENCE_H_
+
+// Decodes a report by reading every usage with state lookups, the way
+// do_handle_received_report() did it before the decode plans. For white-box
+// tests that include remapper.cc.
+
+#include <stdint.h>
+
+inline bool reference_rollover(const uint8_t* report, int len, const std::unordered_map<uint32_t, usage_def_t>& usage_map) {
+    for (auto const& [usage, usage_def] : usage_map) {
+        if (usage_def.usage_maximum == 0) {
+            if (usage != ROLLOVER_USAGE) {
+                continue;
+            }
+            if (usage_def.is_array) {
+                for (unsigned int i = 0; i < usage_def.count; i++) {
+                    if (get_bits(BitsKernel::GENERIC, report, len, usage_def.bitpos + i * usage_def.size, usage_def.size) == usage_def.index) {
+                        return true;
+                    }
+                }
+            } else if (get_bits(BitsKernel::GENERIC, report, len, usage_def.bitpos, usage_def.size) != 0) {
+                return true;
+            }
+        } else if ((usage <= ROLLOVER_USAGE) && (ROLLOVER_USAGE <= usage_def.usage_maximum)) {
+            for (unsigned int i = 0; i < usage_def.count; i++) {
+                if (get_bits(BitsKernel::GENERIC, report, len, usage_def.bitpos + i * usage_def.size, usage_def.size) == usage_def.logical_minimum + ROLLOVER_USAGE - usage) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Reads every usage of the report, looking up the states as it goes.
+inline void reference_decode(const uint8_t* report, int len, uint16_t interface, uint8_t external_report_id) {
+    uint8_t report_id = 0;
+    if (has_report_id_theirs[interface]) {
+        if (external_report_id != 0) {
+            report_id = external_report_id;
+        } else {
+            report_id = report[0];
+            report++;
+            len--;
+        }
+    }
+    uint8_t interface_idx = interface_index[interface];
+    uint8_t hub_port = hub_ports[interface >> 8];
+
+    auto interface_search = their_usages.find(interface);
+    if (interface_search == their_usages.end()) {
+        return;
+    }
+    auto report_search = interface_search->second.find(report_id);
+    if (report_search == interface_search->second.end()) {
+        return;
+    }
+    const std::unordered_map<uint32_t, usage_def_t>& usage_map = report_search->second;
+
+    if (reference_rollover(report, len, usage_map)) {
+        return;
+    }
+
+    for (auto const& [usage, usage_def] : usage_map) {
+        if (usage_def.usage_maximum != 0) {
+            for (uint32_t actual_usage = usage; actual_usage <= usage_def.usage_maximum; actual_usage++) {
+                for (int32_t* state_ptr : { get_state_ptr(actual_usage, 0), get_state_ptr(actual_usage, hub_port) }) {
+                    if (state_ptr != NULL) {
+                        update_state(state_ptr, *state_ptr & ~(1 << interface_idx));
+                    }
+                }
+            }
+        }
+    }
+
+    // non-array usages first, see update_their_descriptor_derivates()
+    for (bool is_array : { false, true }) {
+        for (auto const& [usage, their_usage] : usage_map) {
+            if (their_usage.is_array != is_array) {
+                continue;
+            }
+            usage_def_t usage_def = their_usage;
+            usage_def.bits_kernel = BitsKernel::GENERIC;
+            if (usage_def.usage_maximum != 0) {
+                read_input_range(report, len, usage, usage_def, interface_idx, hub_port);
+                continue;
+            }
+            for (bool raw : { false, true }) {
+                usage_def.input_state_0 = get_state_ptr(usage, 0, false, raw);
+                usage_def.input_state_n = get_state_ptr(usage, hub_port, false, raw);
+                usage_def.should_be_scaled = !raw && should_scale_input(usage_def);
+                if ((usage_def.input_state_0 != NULL) || (usage_def.input_state_n != NULL)) {
+                    read_input(report, len, usage, usage_def, interface_idx);
+                }
+            }
+        }
+    }
+}
+
+#endif
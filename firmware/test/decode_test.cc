@@ -0,0 +1,219 @@
+// Checks the per-report decode plans against decoding every usage of every report,
+// the way do_handle_received_report() did it before the plans existed. Each report
+// is decoded both ways starting from the same input_state and the results have to
+// match, which also covers skipping the usages whose bytes didn't change and the
+// dense array range tables. One device sends reports longer than the 64 bytes whose
+// changes are tracked, with a field that straddles byte 64.
+
+#include "../src/remapper.cc"
+
+#include <chrono>
+
+#include "decode_reference.h"
+#include "scenario.h"
+#include "test.h"
+
+// Keyboard-like device on hub port 3: modifiers plus two consumer control array fields
+// with overlapping usage ranges (report ID 2) and a 16-bit vendor array too wide
+// for a range table (report ID 3).
+#define EXTRA_DEVICE 0x0400
+
+static const uint8_t extra_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x02, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00,
+    0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x05, 0x0C, 0x95, 0x03, 0x75, 0x08, 0x15, 0x00,
+    0x25, 0x65, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0x95, 0x03, 0x75, 0x08, 0x15, 0x04, 0x25, 0x65,
+    0x19, 0x04, 0x29, 0x65, 0x81, 0x00, 0x85, 0x03, 0x06, 0x00, 0xFF, 0x19, 0x01, 0x2A, 0xFF, 0x07,
+    0x15, 0x01, 0x26, 0xFF, 0x07, 0x75, 0x10, 0x95, 0x02, 0x81, 0x00, 0xC0
+};
+
+// Gamepad on hub port 4 with a 69-byte report: 62 bytes of padding, then 8 buttons,
+// 16-bit X and Y and a two key array range. X is in bytes 63 and 64; Y and the keys
+// start past byte 63, so the descriptor parser leaves them out.
+#define LONG_DEVICE 0x0500
+#define LONG_PADDING 62
+
+static const uint8_t long_descriptor[] = {
+    0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, 0x75, 0x08, 0x95, LONG_PADDING, 0x81, 0x01, 0x05, 0x09, 0x19, 0x01,
+    0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x05, 0x01, 0x09, 0x30,
+    0x09, 0x31, 0x15, 0x00, 0x27, 0xFF, 0xFF, 0x00, 0x00, 0x75, 0x10, 0x95, 0x02, 0x81, 0x02, 0x05,
+    0x07, 0x19, 0x00, 0x29, 0x65, 0x15, 0x00, 0x25, 0x65, 0x75, 0x08, 0x95, 0x02, 0x81, 0x00, 0xC0
+};
+
+static uint8_t long_report[LONG_PADDING + 7];
+
+static uint8_t extra_keys_report[8] = { 2 };
+static uint8_t extra_vendor_report[5] = { 3 };
+
+static int32_t before[sizeof(input_state) / sizeof(input_state[0])];
+static int32_t after[sizeof(input_state) / sizeof(input_state[0])];
+
+static uint64_t plan_ns = 0;
+static uint64_t reference_ns = 0;
+static uint32_t reports_compared = 0;
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void compare_decode(const uint8_t* report, int len, uint16_t interface, uint8_t external_report_id) {
+    memcpy(before, input_state, sizeof(input_state));
+
+    uint64_t started = now_ns();
+    do_handle_received_report(report, len, interface, external_report_id);
+    plan_ns += now_ns() - started;
+    memcpy(after, input_state, sizeof(input_state));
+
+    memcpy(input_state, before, sizeof(input_state));
+    started = now_ns();
+    reference_decode(report, len, interface, external_report_id);
+    reference_ns += now_ns() - started;
+
+    for (uint32_t i = 0; i < sizeof(input_state) / sizeof(input_state[0]); i++) {
+        if (input_state[i] != after[i]) {
+            printf("interface 0x%04x, state slot %u\n", interface, i);
+            CHECK_EQ(after[i], input_state[i]);
+            break;
+        }
+    }
+    reports_compared++;
+}
+
+static void extra_input() {
+    static const uint8_t keys[] = { 0, 0, 0, 4, 5, 7, 9, 0x11, 0x13, 0x40, 0x65, 0x01 };
+    static const uint16_t vendor_usages[] = { 0, 0, 2, 3, 4, 0x500, 0x7FF, 1 };
+
+    uint32_t r = scenario_rand();
+    if (r % 5 == 0) {
+        if (scenario_rand() % 3 == 0) {
+            extra_keys_report[1] ^= 1 << (scenario_rand() % 8);
+        }
+        extra_keys_report[2 + scenario_rand() % 6] = keys[scenario_rand() % sizeof(keys)];
+        if (extra_keys_report[5] < 4) {
+            extra_keys_report[5] = 4;  // the second field's logical minimum
+        }
+    }
+    if ((r >> 4) % 3 == 0) {
+        compare_decode(extra_keys_report, sizeof(extra_keys_report), EXTRA_DEVICE, 0);
+    }
+    if ((r >> 6) % 7 == 0) {
+        uint16_t vendor_usage = vendor_usages[scenario_rand() % (sizeof(vendor_usages) / sizeof(vendor_usages[0]))];
+        memcpy(extra_vendor_report + 1 + 2 * (scenario_rand() % 2), &vendor_usage, 2);
+        compare_decode(extra_vendor_report, sizeof(extra_vendor_report), EXTRA_DEVICE, 0);
+    }
+}
+
+static void long_input() {
+    static const uint8_t keys[] = { 0, 0, 4, 5, 7, 0x11, 0x65 };
+
+    uint32_t r = scenario_rand();
+    if (r % 4 != 0) {
+        return;
+    }
+    if ((r >> 2) % 2 == 0) {
+        long_report[LONG_PADDING] = scenario_rand();
+    }
+    if ((r >> 3) % 2 == 0) {
+        // sometimes only X's high byte changes, which is past byte 63
+        uint16_t axis = scenario_rand();
+        memcpy(long_report + LONG_PADDING + 1 + 2 * (scenario_rand() % 2), &axis, (scenario_rand() % 2) ? 1 : 2);
+    }
+    if ((r >> 4) % 3 == 0) {
+        long_report[LONG_PADDING + 5 + scenario_rand() % 2] = keys[scenario_rand() % sizeof(keys)];
+    }
+    compare_decode(long_report, sizeof(long_report), LONG_DEVICE, 0);
+}
+
+// Usages that reach past the bytes changed_report_bytes() tracks have to be read
+// whenever anything changed.
+static void check_byte_masks() {
+    usage_def_t usage_def = {};
+    usage_def.size = 16;
+    usage_def.bitpos = 16;
+    CHECK_EQ(usage_byte_mask(usage_def), 0b1100);
+    usage_def.bitpos = 8 * 62;
+    CHECK_EQ(usage_byte_mask(usage_def), (uint64_t) 0b11 << 62);
+    usage_def.bitpos = 8 * 63;
+    CHECK_EQ(usage_byte_mask(usage_def), UINT64_MAX);
+    usage_def.bitpos = 8 * 70;
+    CHECK_EQ(usage_byte_mask(usage_def), UINT64_MAX);
+    usage_def.size = 8;
+    usage_def.is_array = true;
+    usage_def.count = 6;
+    usage_def.bitpos = 8 * 60;
+    CHECK_EQ(usage_byte_mask(usage_def), UINT64_MAX);
+}
+
+static void extra_config() {
+    config_mappings.push_back((mapping_config11_t){ 0x00070008, 0x000C0009, 1000, 1, 0, 1 << 3 });  // consumer 0x09 on port 3 -> E
+    config_mappings.push_back((mapping_config11_t){ 0x0007000D, 0x000C0040, 1000, 1, 0, 0 });       // consumer 0x40 -> J
+    config_mappings.push_back((mapping_config11_t){ 0x0007000C, 0xFF000500, 1000, 1, 0, 0 });       // vendor 0x500 -> I
+    config_mappings.push_back((mapping_config11_t){ 0x0007000E, 0xFF000002, 1000, 1, 0, 0 });       // vendor 0x02 -> K
+}
+
+int main() {
+    scenario_setup(0);
+    extra_config();
+    set_mapping_from_config();
+    parse_descriptor(0x1234, 4, extra_descriptor, sizeof(extra_descriptor), EXTRA_DEVICE, 0);
+    device_connected_callback(EXTRA_DEVICE, 0x1234, 4, 3);
+    parse_descriptor(0x1234, 5, long_descriptor, sizeof(long_descriptor), LONG_DEVICE, 0);
+    device_connected_callback(LONG_DEVICE, 0x1234, 5, 4);
+    update_their_descriptor_derivates();
+    their_descriptor_updated = false;
+
+    // every report goes through compare_decode()
+    our_descriptor_def_t descriptor = *our_descriptor;
+    descriptor.handle_received_report = compare_decode;
+    our_descriptor = &descriptor;
+
+    for (uint32_t frame = 0; (frame < 30000) && (test_failures < FAILURE_LIMIT); frame++) {
+        if (frame == 15000) {
+            // rebuild with a changed configuration halfway through
+            config_mappings[0].source_usage = 0x00070009;
+            set_mapping_from_config();
+        }
+        // expressions get input_state slots when they first run, like in main()
+        if (their_descriptor_updated) {
+            update_their_descriptor_derivates();
+            their_descriptor_updated = false;
+        }
+        scenario_input(frame);
+        extra_input();
+        long_input();
+        process_mapping(frame % 3 == 0);
+        while (send_report(capture_report)) {
+        }
+    }
+
+    check_byte_masks();
+
+    // make sure the plans actually used what they're supposed to
+    bool fallback_range = false;
+    bool incremental = false;
+    bool not_incremental = false;
+    for (uint32_t j = 0; j < decode_program.reads.size(); j++) {
+        fallback_range |= (decode_program.reads[j].usage_def.usage_maximum != 0) && (decode_program.reads_range[j] == DECODE_RANGE_NONE);
+    }
+    for (auto const& plan : decode_program.plans) {
+        if (plan.array_range_states_end != plan.array_range_states_begin) {
+            incremental |= plan.array_ranges_incremental;
+            not_incremental |= !plan.array_ranges_incremental;
+        }
+    }
+    bool long_plan = false;
+    for (auto const& decode_interface : decode_program.interfaces) {
+        long_plan |= (decode_interface.interface == LONG_DEVICE) && (decode_interface.plans[0] != DECODE_PLAN_NONE);
+    }
+    CHECK(long_plan);
+    CHECK(fallback_range);
+    CHECK(incremental);
+    CHECK(not_incremental);
+    CHECK(!decode_program.ranges.empty());
+    CHECK(report_bytes_skipped > 0);
+    CHECK(reports_compared > 20000);
+
+    printf("decode: %.0f ns/report with plans, %.0f ns/report reading everything\n",
+        (double) plan_ns / reports_compared, (double) reference_ns / reports_compared);
+
+    return test_result("decode_test");
+}
@@ -0,0 +1,237 @@
+// Checks the compiled mapping program against a direct evaluation of
+// reverse_mapping, the way process_mapping() did it before the program existed.
+// Also covers the dirty tracking: a target that wasn't re-evaluated must still
+// hold the value a full evaluation would produce.
+
+#include "../src/remapper.cc"
+
+#include <chrono>
+
+#include "scenario.h"
+#include "test.h"
+
+static int32_t reference_absolute(const reverse_mapping_t& rev_map) {
+    bool register_target = (rev_map.target & 0xFFFF0000) == REGISTER_USAGE_PAGE;
+    int32_t value = rev_map.default_value;
+    for (auto const& map_source : rev_map.sources) {
+        if ((map_source.orig_source_port != 0) &&
+            !(active_ports_mask & (1 << map_source.orig_source_port))) {
+            continue;
+        }
+        bool fixed_point = ((map_source.usage & 0xFFFF0000) == EXPR_USAGE_PAGE) ||
+                           ((map_source.usage & 0xFFFF0000) == REGISTER_USAGE_PAGE);
+        if (map_source.sticky) {
+            if (*map_source.sticky_state & map_source.layer_mask) {
+                value += 1 * map_source.scaling / 1000 - rev_map.default_value;
+            }
+        } else if (layer_state_mask & map_source.layer_mask) {
+            if ((map_source.tap && map_source.tap_hold_state->tap) ||
+                (map_source.hold && map_source.tap_hold_state->hold)) {
+                value += 1 * map_source.scaling / 1000 - rev_map.default_value;
+            }
+            if (!map_source.tap && !map_source.hold) {
+                if (map_source.is_relative && !register_target) {
+                    if (*map_source.input_state * map_source.scaling > 0) {
+                        value += 1;
+                    }
+                } else if ((*map_source.input_state != 0) || (rev_map.default_value != 0)) {
+                    int32_t candidate = *map_source.input_state;
+                    if (map_source.is_binary) {
+                        candidate = !!candidate;
+                    }
+                    if ((candidate != 0) || !map_source.is_binary) {
+                        candidate = (int64_t) candidate * map_source.scaling / 1000;
+                        if (fixed_point) {
+                            candidate /= 1000;
+                        }
+                        if (candidate != rev_map.default_value) {
+                            value += candidate - rev_map.default_value;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if ((value < 0) && !register_target) {
+        value = 0;
+    }
+    if (register_target) {
+        value *= 1000;
+    }
+    return value;
+}
+
+static int32_t reference_relative(const reverse_mapping_t& rev_map, bool auto_repeat) {
+    int32_t sum = 0;
+    for (auto const& map_source : rev_map.sources) {
+        if ((map_source.orig_source_port != 0) &&
+            !(active_ports_mask & (1 << map_source.orig_source_port))) {
+            continue;
+        }
+        if (!auto_repeat && !map_source.is_relative) {
+            continue;
+        }
+        int32_t value = 0;
+        if (map_source.sticky) {
+            value = !!(*map_source.sticky_state & map_source.layer_mask) * map_source.scaling;
+        } else if (layer_state_mask & map_source.layer_mask) {
+            value = map_source.hold ? map_source.tap_hold_state->hold : *map_source.input_state;
+            if (map_source.is_binary) {
+                value = !!value;
+            }
+            value *= map_source.scaling;
+            if (((map_source.usage & 0xFFFF0000) == EXPR_USAGE_PAGE) ||
+                ((map_source.usage & 0xFFFF0000) == REGISTER_USAGE_PAGE)) {
+                value /= 1000;
+            }
+        }
+        sum += value;
+    }
+    return sum;
+}
+
+static std::chrono::steady_clock::duration time_process_mapping(uint32_t frames) {
+    std::chrono::steady_clock::duration total(0);
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        scenario_input(frame);
+        auto start = std::chrono::steady_clock::now();
+        process_mapping(frame % 3 == 0);
+        total += std::chrono::steady_clock::now() - start;
+        while (send_report(capture_report)) {
+        }
+        captured_reports.clear();
+    }
+    return total;
+}
+
+// Per frame cost with a few hundred mappings: the old mapping stage, walking
+// reverse_mapping and putting every target into the reports, against a whole
+// process_mapping() call with the mapping program. process_mapping() with no
+// mappings at all shows roughly what the stages other than mapping cost.
+static void benchmark() {
+    const uint32_t frames = 20000;
+    config_mappings.clear();
+    unmapped_passthrough_layer_mask = 0;
+    set_mapping_from_config();
+    auto rest = time_process_mapping(frames);
+
+    scenario_config();
+    unmapped_passthrough_layer_mask = 0;
+    for (uint8_t layer = 0; layer < 4; layer++) {
+        for (uint32_t key = 0x04; key < 0x50; key++) {
+            config_mappings.push_back((mapping_config11_t){ 0x00070000 | (key + 1), 0x00070000 | key, 1000, (uint8_t) (1 << layer), 0, 0 });
+        }
+    }
+    set_mapping_from_config();
+
+    std::chrono::steady_clock::duration walk(0);
+    int32_t sum = 0;
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        scenario_input(frame);
+        bool auto_repeat = frame % 3 == 0;
+        auto start = std::chrono::steady_clock::now();
+        for (auto const& rev_map : reverse_mapping) {
+            int32_t value = rev_map.is_relative ? reference_relative(rev_map, auto_repeat) : reference_absolute(rev_map);
+            for (auto const& out_usage_def : rev_map.our_usages) {
+                put_usage(out_usage_def, value);
+            }
+            sum += value;
+        }
+        for (int32_t* state : relative_usages) {
+            *state = 0;
+        }
+        walk += std::chrono::steady_clock::now() - start;
+    }
+
+    auto program = time_process_mapping(frames);
+
+    printf("%zu mappings, %zu targets: reverse_mapping walk %lld ns/frame, process_mapping() %lld ns/frame, %lld ns/frame without mappings (%d)\n",
+        config_mappings.size(), reverse_mapping.size(),
+        (long long) std::chrono::duration_cast<std::chrono::nanoseconds>(walk).count() / frames,
+        (long long) std::chrono::duration_cast<std::chrono::nanoseconds>(program).count() / frames,
+        (long long) std::chrono::duration_cast<std::chrono::nanoseconds>(rest).count() / frames, sum);
+}
+
+int main() {
+    scenario_setup(0);
+
+    uint32_t nonzero_absolute = 0;
+    uint32_t nonzero_relative = 0;
+    uint32_t skipped_evaluations = 0;
+
+    for (uint32_t frame = 0; (frame < 20000) && (test_failures < FAILURE_LIMIT); frame++) {
+        if (frame == 10000) {
+            // rebuild with a changed configuration halfway through
+            config_mappings[7].scaling = 750;
+            config_mappings.push_back((mapping_config11_t){ 0x00070020, 0x0007001D, 1000, 0b11, 0, 0 });
+            set_mapping_from_config();
+        }
+
+        scenario_input(frame);
+        bool auto_repeat = frame % 3 == 0;
+
+        // process_mapping() zeroes relative inputs once it's done with them,
+        // we need them to recompute what it did.
+        std::vector<int32_t> relative_values;
+        for (int32_t* state : relative_usages) {
+            relative_values.push_back(*state);
+        }
+        std::unordered_map<uint32_t, int32_t> accumulated_before = accumulated;
+
+        uint32_t evaluated = 0;
+        for (uint16_t t = 0; t < mapping_program.targets.size(); t++) {
+            mapping_target_t& target = mapping_program.targets[t];
+            if (!(target.flags & TARGET_FLAG_RELATIVE) &&
+                (all_targets_dirty || (target.flags & TARGET_FLAG_ALWAYS_DIRTY) || mapping_program.target_dirty[t])) {
+                evaluated++;
+            }
+        }
+
+        process_mapping(auto_repeat);
+
+        for (uint32_t i = 0; i < relative_usages.size(); i++) {
+            *relative_usages[i] = relative_values[i];
+        }
+
+        CHECK_EQ(mapping_program.targets.size(), reverse_mapping.size());
+        std::unordered_map<uint32_t, int32_t> expected_relative;
+        for (uint16_t t = 0; t < reverse_mapping.size(); t++) {
+            const reverse_mapping_t& rev_map = reverse_mapping[t];
+            const mapping_target_t& target = mapping_program.targets[t];
+            CHECK_EQ(target.target, rev_map.target);
+            if (rev_map.is_relative) {
+                expected_relative[rev_map.target] += reference_relative(rev_map, auto_repeat);
+            } else {
+                int32_t expected = reference_absolute(rev_map);
+                CHECK_EQ(target.cached_value, expected);
+                nonzero_absolute += expected != rev_map.default_value;
+            }
+        }
+        for (auto const& [usage, movement] : expected_relative) {
+            // scroll goes through handle_scroll(), which has its own state
+            if ((usage == V_SCROLL_USAGE) || (usage == H_SCROLL_USAGE)) {
+                continue;
+            }
+            int32_t total = accumulated_before[usage] + movement;
+            CHECK_EQ(accumulated[usage], total - total / 1000 * 1000);
+            nonzero_relative += movement != 0;
+        }
+
+        for (int32_t* state : relative_usages) {
+            *state = 0;
+        }
+        while (send_report(capture_report)) {
+        }
+        skipped_evaluations += mapping_program.targets.size() - evaluated;
+    }
+
+    // make sure the scenario actually exercised something
+    CHECK(nonzero_absolute > 10000);
+    CHECK(nonzero_relative > 1000);
+    CHECK(skipped_evaluations > 0);
+    CHECK(captured_reports.size() > 1000);
+
+    benchmark();
+
+    return test_result("mapping_program_test");
+}
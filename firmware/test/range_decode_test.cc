@@ -0,0 +1,209 @@
+// Checks the dense array range tables against looking up the state of every
+// reported key, on a 6KRO boot keyboard and a 104-key NKRO keyboard whose keys
+// are an array range. Then times decoding their reports both ways. A keyboard
+// whose array has a negative logical minimum doesn't get range tables.
+
+#include "../src/remapper.cc"
+
+#include <chrono>
+
+#include "decode_reference.h"
+#include "scenario.h"
+#include "test.h"
+
+#define BOOT_KEYBOARD 0x0100
+#define NKRO_KEYBOARD 0x0200
+#define SIGNED_KEYBOARD 0x0300
+
+#define FIRST_KEY 0x04
+#define NKEYS 104
+
+static const uint8_t boot_keyboard_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x06, 0x75, 0x08,
+    0x15, 0x00, 0x25, 0x65, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0
+};
+
+// modifiers and an array of 104 keys, so every key can be down at the same time
+static const uint8_t nkro_keyboard_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, NKEYS, 0x75, 0x08, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x19,
+    0x00, 0x2A, 0xFF, 0x00, 0x81, 0x00, 0xC0
+};
+
+// the boot keyboard with a logical minimum of -1 on its key array
+static const uint8_t signed_keyboard_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x06, 0x75, 0x08,
+    0x15, 0xFF, 0x25, 0x64, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0
+};
+
+struct key_reports_t {
+    uint8_t boot[8];
+    uint8_t nkro[1 + NKEYS];
+};
+
+static bool pressed[256];
+
+static void make_reports(key_reports_t& reports) {
+    memset(&reports, 0, sizeof(reports));
+    uint32_t boot_count = 0;
+    uint32_t nkro_count = 0;
+    for (uint32_t key = 0; key < 256; key++) {
+        if (!pressed[key]) {
+            continue;
+        }
+        if (boot_count < 6) {
+            reports.boot[2 + boot_count++] = key;
+        } else {
+            memset(reports.boot + 2, 0x01, 6);  // ErrorRollOver
+        }
+        if (nkro_count < NKEYS) {
+            reports.nkro[1 + nkro_count++] = key;
+        }
+    }
+    reports.boot[0] = reports.nkro[0] = scenario_rand() % 4 == 0 ? scenario_rand() : 0;
+}
+
+static void next_keys() {
+    uint32_t toggles = 1 + scenario_rand() % 3;
+    for (uint32_t i = 0; i < toggles; i++) {
+        // mostly mapped keys, sometimes ones outside the range tables
+        uint32_t key = (scenario_rand() % 8 != 0) ? FIRST_KEY + scenario_rand() % NKEYS : scenario_rand() % 256;
+        pressed[key] = !pressed[key];
+    }
+}
+
+static int32_t before[sizeof(input_state) / sizeof(input_state[0])];
+static int32_t after[sizeof(input_state) / sizeof(input_state[0])];
+
+static void compare_decode(const uint8_t* report, int len, uint16_t interface) {
+    memcpy(before, input_state, sizeof(input_state));
+    do_handle_received_report(report, len, interface, 0);
+    memcpy(after, input_state, sizeof(input_state));
+    memcpy(input_state, before, sizeof(input_state));
+    reference_decode(report, len, interface, 0);
+
+    for (uint32_t i = 0; i < sizeof(input_state) / sizeof(input_state[0]); i++) {
+        if (input_state[i] != after[i]) {
+            printf("interface 0x%04x, state slot %u\n", interface, i);
+            CHECK_EQ(after[i], input_state[i]);
+            break;
+        }
+    }
+}
+
+static double time_decode(const std::vector<key_reports_t>& sequence, uint16_t interface, void (*decode)(const uint8_t*, int, uint16_t, uint8_t)) {
+    auto started = std::chrono::steady_clock::now();
+    uint32_t decoded = 0;
+    for (int repeat = 0; repeat < 20; repeat++) {
+        for (auto const& reports : sequence) {
+            if (interface == BOOT_KEYBOARD) {
+                decode(reports.boot, sizeof(reports.boot), interface, 0);
+            } else {
+                decode(reports.nkro, sizeof(reports.nkro), interface, 0);
+            }
+            decoded++;
+        }
+    }
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count() / decoded;
+}
+
+static void connect(uint16_t interface) {
+    if (interface == BOOT_KEYBOARD) {
+        parse_descriptor(0x1234, 1, boot_keyboard_descriptor, sizeof(boot_keyboard_descriptor), BOOT_KEYBOARD, 0);
+        device_connected_callback(BOOT_KEYBOARD, 0x1234, 1, 0);
+    } else if (interface == NKRO_KEYBOARD) {
+        parse_descriptor(0x1234, 2, nkro_keyboard_descriptor, sizeof(nkro_keyboard_descriptor), NKRO_KEYBOARD, 0);
+        device_connected_callback(NKRO_KEYBOARD, 0x1234, 2, 2);
+    } else {
+        parse_descriptor(0x1234, 3, signed_keyboard_descriptor, sizeof(signed_keyboard_descriptor), SIGNED_KEYBOARD, 0);
+        device_connected_callback(SIGNED_KEYBOARD, 0x1234, 3, 0);
+    }
+    update_their_descriptor_derivates();
+    their_descriptor_updated = false;
+}
+
+static void disconnect(uint16_t interface) {
+    device_disconnected_callback(interface >> 8);
+    update_their_descriptor_derivates();
+    their_descriptor_updated = false;
+}
+
+// Feeds random key changes to the connected keyboards, comparing each report's
+// decoding, and returns the reports for timing.
+static std::vector<key_reports_t> run(std::initializer_list<uint16_t> interfaces, uint32_t steps) {
+    std::vector<key_reports_t> sequence;
+    for (uint32_t step = 0; (step < steps) && (test_failures < FAILURE_LIMIT); step++) {
+        next_keys();
+        if (step % 2500 == 2499) {
+            memset(pressed, 0, sizeof(pressed));
+        }
+        key_reports_t reports;
+        make_reports(reports);
+        for (uint16_t interface : interfaces) {
+            if ((interface == BOOT_KEYBOARD) || (interface == SIGNED_KEYBOARD)) {
+                compare_decode(reports.boot, sizeof(reports.boot), interface);
+            } else {
+                compare_decode(reports.nkro, sizeof(reports.nkro), NKRO_KEYBOARD);
+            }
+        }
+        sequence.push_back(reports);
+    }
+    return sequence;
+}
+
+static void benchmark(const std::vector<key_reports_t>& sequence, uint16_t interface) {
+    double with_tables = time_decode(sequence, interface, do_handle_received_report);
+    double with_lookups = time_decode(sequence, interface, reference_decode);
+    printf("%s: %.0f ns/report with range tables, %.0f ns/report with lookups\n",
+        (interface == BOOT_KEYBOARD) ? "6KRO" : "104-key NKRO", with_tables, with_lookups);
+}
+
+static void check_plans(bool incremental) {
+    CHECK(!decode_program.ranges.empty());
+    for (auto const& plan : decode_program.plans) {
+        CHECK_EQ(plan.array_ranges_incremental, incremental);
+    }
+}
+
+int main() {
+    our_descriptor_number = 0;
+    our_descriptor = &our_descriptors[0];
+    config_mappings.clear();
+    unmapped_passthrough_layer_mask = 0;
+    for (uint32_t key = FIRST_KEY; key < FIRST_KEY + NKEYS; key++) {
+        config_mappings.push_back((mapping_config11_t){ 0x00070000 | key, 0x00070000 | key, 1000, 1, 0, 0 });
+    }
+    config_mappings.push_back((mapping_config11_t){ 0x000700E3, 0x00070004, 1000, 1, 0, 1 << 2 });  // A on port 2 -> left GUI
+    parse_our_descriptor();
+    set_mapping_from_config();
+
+    // both keyboards write the same states, so their range tables are cleared before each report
+    connect(BOOT_KEYBOARD);
+    connect(NKRO_KEYBOARD);
+    check_plans(false);
+    run({ BOOT_KEYBOARD, NKRO_KEYBOARD }, 10000);
+
+    // on their own, only the keys that changed are updated
+    disconnect(BOOT_KEYBOARD);
+    check_plans(true);
+    benchmark(run({ NKRO_KEYBOARD }, 10000), NKRO_KEYBOARD);
+
+    connect(BOOT_KEYBOARD);
+    disconnect(NKRO_KEYBOARD);
+    check_plans(true);
+    benchmark(run({ BOOT_KEYBOARD }, 10000), BOOT_KEYBOARD);
+
+    // negative indexes are read without range tables, the same as before
+    disconnect(BOOT_KEYBOARD);
+    connect(SIGNED_KEYBOARD);
+    CHECK(decode_program.ranges.empty());
+    run({ SIGNED_KEYBOARD }, 2000);
+    for (uint8_t key : { 0xFF, 0x00, 0x04, 0x64, 0x65 }) {
+        uint8_t report[8] = { 0, 0, key, 0, 0, 0, 0, 0 };
+        compare_decode(report, sizeof(report), SIGNED_KEYBOARD);
+    }
+
+    return test_result("range_decode_test");
+}
@@ -0,0 +1,78 @@
+// Absolute targets only get put into the report images when their value changes.
+// Checks that the images always match a report put together from scratch from all
+// targets' current values, the way it's done when everything is dirty.
+
+#include "../src/remapper.cc"
+
+#include "scenario.h"
+#include "test.h"
+
+static void put_from_scratch(uint8_t report_id, uint8_t* report) {
+    memset(report, 0, MAX_REPORT_SIZE);
+    if (our_descriptor->clear_report != nullptr) {
+        our_descriptor->clear_report(report, report_id, report_sizes[report_id]);
+    }
+    for (auto const& target : mapping_program.targets) {
+        if ((target.flags & TARGET_FLAG_RELATIVE) || (target.cached_value == target.default_value)) {
+            continue;
+        }
+        for (uint16_t i = target.our_usages_begin; i < target.our_usages_end; i++) {
+            const out_usage_def_t& out_usage_def = mapping_program.our_usages[i];
+            if ((out_usage_def.data != NULL) || (out_usage_def.report_id != report_id)) {
+                continue;
+            }
+            if (out_usage_def.array_count == 0) {
+                uint32_t value = target.cached_value;
+                if ((out_usage_def.size < 32) && (value > ((1u << out_usage_def.size) - 1))) {
+                    value = (1 << out_usage_def.size) - 1;
+                }
+                put_bits(report, report_sizes[report_id], out_usage_def.bitpos, out_usage_def.size, value);
+            } else {
+                for (int j = 0; j < out_usage_def.array_count; j++) {
+                    if (get_bits(report, report_sizes[report_id], out_usage_def.bitpos + j * out_usage_def.size, out_usage_def.size) == 0) {
+                        put_bits(report, report_sizes[report_id], out_usage_def.bitpos + j * out_usage_def.size, out_usage_def.size, out_usage_def.array_index);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void run(uint8_t descriptor_number, bool boot_protocol) {
+    boot_protocol_keyboard = boot_protocol;
+    scenario_setup(descriptor_number);
+
+    uint32_t exclusive_targets = 0;
+    for (auto const& target : mapping_program.targets) {
+        exclusive_targets += !!(target.flags & TARGET_FLAG_EXCLUSIVE);
+    }
+    CHECK(exclusive_targets > 0);
+
+    uint32_t changes = 0;
+    for (uint32_t frame = 0; (frame < 5000) && (test_failures < FAILURE_LIMIT); frame++) {
+        std::vector<uint8_t> images_before((uint8_t*) report_images, (uint8_t*) report_images + sizeof(report_images));
+
+        scenario_frame(frame);
+
+        for (uint8_t report_id : report_ids) {
+            alignas(4) uint8_t expected[MAX_REPORT_SIZE];
+            put_from_scratch(report_id, expected);
+            if (memcmp(expected, report_images[report_id], report_sizes[report_id])) {
+                printf("descriptor %d%s, frame %d: report ID %d image differs\n", descriptor_number, boot_protocol ? " (boot)" : "", frame, report_id);
+                test_failures++;
+            }
+        }
+        changes += memcmp(images_before.data(), report_images, sizeof(report_images)) != 0;
+    }
+    CHECK(changes > 100);
+}
+
+int main() {
+    for (uint8_t descriptor_number = 0; descriptor_number < NOUR_DESCRIPTORS; descriptor_number++) {
+        run(descriptor_number, false);
+    }
+    run(0, true);
+
+    return test_result("report_image_test");
+}
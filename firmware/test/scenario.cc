@@ -0,0 +1,189 @@
+#include "scenario.h"
+
+#include <string.h>
+
+#include "descriptor_parser.h"
+#include "globals.h"
+#include "our_descriptor.h"
+#include "remapper.h"
+
+std::vector<captured_report_t> captured_reports;
+
+static uint32_t rand_state = 12345;
+
+uint32_t scenario_rand() {
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+// boot keyboard with LED outputs
+static const uint8_t keyboard_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01,
+    0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06,
+    0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0
+};
+
+// 5 buttons, 16-bit X/Y, 8-bit wheel
+static const uint8_t mouse_descriptor[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x05,
+    0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x03, 0x81, 0x01,
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02,
+    0x81, 0x06, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 0xC0
+};
+
+// 16 buttons, hat switch, 8-bit, 16-bit and 10-bit axes, report ID 1
+static const uint8_t gamepad_descriptor[] = {
+    0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, 0x85, 0x01, 0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00,
+    0x25, 0x01, 0x75, 0x01, 0x95, 0x10, 0x81, 0x02, 0x05, 0x01, 0x09, 0x39, 0x15, 0x00, 0x25, 0x07,
+    0x75, 0x04, 0x95, 0x01, 0x81, 0x42, 0x75, 0x04, 0x95, 0x01, 0x81, 0x01, 0x09, 0x30, 0x09, 0x31,
+    0x09, 0x32, 0x09, 0x35, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x95, 0x04, 0x81, 0x02, 0x09,
+    0x33, 0x09, 0x34, 0x15, 0x00, 0x27, 0xFF, 0xFF, 0x00, 0x00, 0x75, 0x10, 0x95, 0x02, 0x81, 0x02,
+    0x09, 0x36, 0x15, 0x00, 0x26, 0xFF, 0x03, 0x75, 0x0A, 0x95, 0x01, 0x81, 0x02, 0x75, 0x06, 0x95,
+    0x01, 0x81, 0x01, 0xC0
+};
+
+static uint8_t keyboard_report[8];
+static uint8_t mouse_report[6];
+static uint8_t gamepad_report[14];
+
+static void add_mapping(uint32_t target, uint32_t source, int32_t scaling = 1000, uint8_t layer_mask = 1, uint8_t flags = 0, uint8_t hub_ports = 0) {
+    config_mappings.push_back((mapping_config11_t){ target, source, scaling, layer_mask, flags, hub_ports });
+}
+
+static void set_expression(uint8_t expr, std::vector<expr_elem_t> elems) {
+    expressions[expr] = elems;
+}
+
+void scenario_config() {
+    config_mappings.clear();
+    unmapped_passthrough_layer_mask = 0b0101;
+
+    add_mapping(0x00070004, 0x00070005);                       // B -> A
+    add_mapping(0x00070006, 0x00070007, 1000, 1, 1);           // sticky D -> C
+    add_mapping(0xFFF10001, 0x000700E1);                       // left shift -> layer 1
+    add_mapping(0x00070010, 0x00070011, 1000, 2);              // N -> M on layer 1
+    add_mapping(0xFFF10002, 0x00070039, 1000, 1, 2);           // caps lock tap -> layer 2
+    add_mapping(0x00070012, 0x00070013, 1000, 1, 4);           // P hold -> O
+    add_mapping(0x00070014, 0x00070015, 1000, 1, 2);           // R tap -> Q
+    add_mapping(0x00010030, 0x00010030, 500);                  // mouse X at half speed
+    add_mapping(0x00010031, 0x00010031, -1000);                // mouse Y inverted
+    add_mapping(0x00010038, 0x00090005, 1000);                 // button 5 -> scroll
+    add_mapping(0x00010030, 0xFFF30001);                       // expression 1 -> X
+    add_mapping(0x00010031, 0xFFF30002);                       // expression 2 -> Y
+    add_mapping(0x00090001, 0x00090002);                       // button 2 -> button 1
+    add_mapping(0x00090001, 0x00090003, 1000, 1, 0, 1 << 2);   // button 3 on port 2 -> button 1
+    add_mapping(0xFFF20001, 0x00070016);                       // S -> macro 1
+    add_mapping(0xFFF50001, 0x00090004);                       // button 4 -> register 1
+    add_mapping(0x00070017, 0xFFF50001);                       // register 1 -> T
+    add_mapping(0x0007001A, 0xFFF30003);                       // expression 3 -> W
+    add_mapping(0x00010032, 0x00010033, 1000);                 // Rx -> Z
+    add_mapping(0x00010035, 0x00010036);                       // 10-bit slider -> Rz
+    add_mapping(0x00010039, 0x00010039);                       // hat switch
+    add_mapping(0xFFF90001, 0x00090007);                       // button 7 -> d-pad left
+    add_mapping(0xFFF40003, 0x00090008);                       // button 8 -> GPIO 3
+    add_mapping(0x000C00E9, 0x00090009);                       // button 9 -> volume up
+    add_mapping(0x00080001, 0x00070053);                       // num lock -> keyboard LED
+
+    macros[0] = { { 0x00070004, 0x00070005 }, { 0x000700E1, 0x0007000B } };
+
+    set_expression(0, { { Op::PUSH_USAGE, 0x00010030 }, { Op::INPUT_STATE, 0 }, { Op::PUSH, (uint32_t) -128000 }, { Op::ADD, 0 }, { Op::DUP, 0 }, { Op::ABS, 0 }, { Op::PUSH, 10000 }, { Op::GT, 0 }, { Op::MUL, 0 }, { Op::PUSH, 25 }, { Op::MUL, 0 } });
+    set_expression(1, { { Op::PUSH_USAGE, 0x00010039 }, { Op::INPUT_STATE, 0 }, { Op::PUSH, 7000 }, { Op::GT, 0 }, { Op::NOT, 0 }, { Op::PUSH_USAGE, 0x00010039 }, { Op::INPUT_STATE, 0 }, { Op::PUSH, 45000 }, { Op::MUL, 0 }, { Op::COS, 0 }, { Op::PUSH, (uint32_t) -1000 }, { Op::MUL, 0 }, { Op::MUL, 0 } });
+    set_expression(2, { { Op::TIME, 0 }, { Op::PUSH, 200000 }, { Op::MOD, 0 }, { Op::PUSH, 100000 }, { Op::GT, 0 }, { Op::PUSH_USAGE, 0x00090006 }, { Op::INPUT_STATE_BINARY, 0 }, { Op::MUL, 0 } });
+    set_expression(3, { { Op::PUSH_USAGE, 0x00010031 }, { Op::INPUT_STATE, 0 }, { Op::ABS, 0 }, { Op::PUSH, 3000 }, { Op::GT, 0 }, { Op::PUSH, 1000 }, { Op::RECALL, 0 }, { Op::ADD, 0 }, { Op::PUSH, 2000 }, { Op::STORE, 0 } });
+    set_expression(4, { { Op::PUSH_USAGE, 0x00010033 }, { Op::INPUT_STATE_SCALED, 0 }, { Op::PUSH_USAGE, 0x00010034 }, { Op::INPUT_STATE_SCALED, 0 }, { Op::ATAN2, 0 }, { Op::SIN, 0 }, { Op::SQRT, 0 }, { Op::PUSH, 2000 }, { Op::PORT, 0 }, { Op::PUSH_USAGE, 0x00090001 }, { Op::INPUT_STATE_BINARY, 0 }, { Op::ADD, 0 }, { Op::PUSH, 0 }, { Op::PORT, 0 }, { Op::PUSH_USAGE, 0x00010032 }, { Op::INPUT_STATE, 0 }, { Op::PUSH_USAGE, 0x00010035 }, { Op::INPUT_STATE, 0 }, { Op::PUSH, 20000 }, { Op::DEADZONE, 0 }, { Op::ADD, 0 }, { Op::ADD, 0 }, { Op::LAYER_STATE, 0 }, { Op::ADD, 0 }, { Op::PUSH_USAGE, 0x00070011 }, { Op::TAP_STATE, 0 }, { Op::ADD, 0 }, { Op::PUSH_USAGE, 0x00070013 }, { Op::HOLD_STATE, 0 }, { Op::ADD, 0 }, { Op::PUSH_USAGE, 0x00070007 }, { Op::STICKY_STATE, 0 }, { Op::ADD, 0 }, { Op::PUSH_USAGE, 0xFFF30002 }, { Op::MONITOR, 0 } });
+    set_expression(5, { { Op::PUSH_USAGE, 0x00010036 }, { Op::PREV_INPUT_STATE, 0 }, { Op::PUSH_USAGE, 0x00010036 }, { Op::INPUT_STATE, 0 }, { Op::SUB, 0 }, { Op::PUSH, 3000 }, { Op::DIV, 0 }, { Op::ROUND, 0 }, { Op::PUSH, 0 }, { Op::PUSH, 5000 }, { Op::CLAMP, 0 }, { Op::PUSH_USAGE, 0x00070005 }, { Op::PREV_INPUT_STATE_BINARY, 0 }, { Op::PUSH_USAGE, 0x00070006 }, { Op::INPUT_STATE_BINARY, 0 }, { Op::PUSH, 1000 }, { Op::PUSH, 0 }, { Op::DPAD, 0 }, { Op::MAX, 0 }, { Op::AUTO_REPEAT, 0 }, { Op::MIN, 0 }, { Op::PUSH, 3000 }, { Op::LT, 0 }, { Op::SIGN, 0 }, { Op::BITWISE_NOT, 0 }, { Op::BITWISE_NOT, 0 }, { Op::PUSH, 1 }, { Op::BITWISE_OR, 0 }, { Op::PUSH, 3 }, { Op::BITWISE_AND, 0 }, { Op::PLUGGED_IN, 0 }, { Op::SWAP, 0 }, { Op::PUSH, 1000 }, { Op::IFTE, 0 }, { Op::TIME_SEC, 0 }, { Op::EQ, 0 }, { Op::SCALING, 0 }, { Op::RELU, 0 }, { Op::MUL, 0 } });
+}
+
+void scenario_connect() {
+    memset(keyboard_report, 0, sizeof(keyboard_report));
+    memset(mouse_report, 0, sizeof(mouse_report));
+    memset(gamepad_report, 0, sizeof(gamepad_report));
+    gamepad_report[0] = 1;
+
+    parse_descriptor(0x1234, 1, keyboard_descriptor, sizeof(keyboard_descriptor), SCENARIO_KEYBOARD, 0);
+    device_connected_callback(SCENARIO_KEYBOARD, 0x1234, 1, 0);
+    parse_descriptor(0x1234, 2, mouse_descriptor, sizeof(mouse_descriptor), SCENARIO_MOUSE, 0);
+    device_connected_callback(SCENARIO_MOUSE, 0x1234, 2, 1);
+    parse_descriptor(0x1234, 3, gamepad_descriptor, sizeof(gamepad_descriptor), SCENARIO_GAMEPAD, 0);
+    device_connected_callback(SCENARIO_GAMEPAD, 0x1234, 3, 2);
+}
+
+void scenario_setup(uint8_t descriptor_number) {
+    our_descriptor_number = descriptor_number;
+    our_descriptor = &our_descriptors[descriptor_number];
+    scenario_config();
+    parse_our_descriptor();
+    set_mapping_from_config();
+    scenario_connect();
+    update_their_descriptor_derivates();
+    their_descriptor_updated = false;
+}
+
+void scenario_input(uint32_t frame) {
+    fake_time += 1000;
+
+    uint32_t r = scenario_rand();
+    if (r % 7 == 0) {
+        static const uint8_t keys[] = { 0, 0, 4, 5, 7, 0x11, 0x13, 0x15, 0x16, 0x39, 0x53, 0x1d, 0x01, 0x2c };
+        keyboard_report[2 + scenario_rand() % 6] = keys[scenario_rand() % sizeof(keys)];
+        if (scenario_rand() % 3 == 0) {
+            keyboard_report[0] ^= 1 << (scenario_rand() % 8);
+        }
+    }
+    if ((r >> 3) % 2 == 0) {
+        handle_received_report(keyboard_report, sizeof(keyboard_report), SCENARIO_KEYBOARD);
+    }
+    if ((r >> 5) % 3 == 0) {
+        int16_t x = (int16_t) (scenario_rand() % 41) - 20;
+        int16_t y = (int16_t) (scenario_rand() % 9) - 4;
+        mouse_report[0] = scenario_rand() % 32 & (scenario_rand() % 4 ? 0x0F : 0x1F);
+        memcpy(mouse_report + 1, &x, 2);
+        memcpy(mouse_report + 3, &y, 2);
+        mouse_report[5] = (scenario_rand() % 5 == 0) ? (int8_t) (scenario_rand() % 3 - 1) : 0;
+        handle_received_report(mouse_report, sizeof(mouse_report), SCENARIO_MOUSE);
+    }
+    if ((r >> 7) % 4 == 0) {
+        if (scenario_rand() % 4 == 0) {
+            uint16_t buttons = scenario_rand();
+            memcpy(gamepad_report + 1, &buttons, 2);
+        }
+        if (scenario_rand() % 5 == 0) {
+            gamepad_report[3] = scenario_rand() % 12;
+        }
+        if (scenario_rand() % 3 == 0) {
+            gamepad_report[4 + scenario_rand() % 4] = scenario_rand();
+        }
+        if (scenario_rand() % 3 == 0) {
+            uint16_t axis = scenario_rand();
+            memcpy(gamepad_report + 8 + 2 * (scenario_rand() % 2), &axis, 2);
+        }
+        if (scenario_rand() % 3 == 0) {
+            uint16_t axis = scenario_rand() & 0x3FF;
+            gamepad_report[12] = axis;
+            gamepad_report[13] = (gamepad_report[13] & 0xFC) | (axis >> 8);
+        }
+        handle_received_report(gamepad_report, sizeof(gamepad_report), SCENARIO_GAMEPAD);
+    }
+    if (frame % 97 == 0) {
+        uint8_t midi[4] = { 0x09, 0x90, (uint8_t) (60 + frame % 3), (uint8_t) (frame % 127) };
+        handle_received_midi(frame % 2, midi);
+    }
+    if (frame % 50 == 0) {
+        set_input_state(GPIO_USAGE_PAGE | 5, frame % 100 == 0, frame % 100 == 0);
+    }
+}
+
+void scenario_frame(uint32_t frame) {
+    scenario_input(frame);
+    process_mapping(frame % 3 == 0);
+    while (send_report(capture_report)) {
+    }
+}
+
+bool capture_report(uint8_t interface, const uint8_t* report_with_id, uint8_t len) {
+    captured_report_t captured = { .interface = interface, .report_id = report_with_id[0] };
+    captured.data.assign(report_with_id, report_with_id + len);
+    captured_reports.push_back(captured);
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef _SCENARIO_H_
+#define _SCENARIO_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+// A keyboard, a mouse and a gamepad (on hub port 2) plus a configuration that
+// exercises most mapping features: layers, sticky, tap/hold, scaling, macros,
+// registers, expressions, GPIO and device-bound OUTPUT usages.
+
+#define SCENARIO_KEYBOARD 0x0100
+#define SCENARIO_MOUSE 0x0200
+#define SCENARIO_GAMEPAD 0x0300
+
+struct captured_report_t {
+    uint16_t interface;
+    uint8_t report_id;
+    std::vector<uint8_t> data;
+};
+
+extern uint64_t fake_time;
+extern std::vector<captured_report_t> captured_reports;      // filled by capture_report()
+extern std::vector<captured_report_t> captured_out_reports;  // filled by queue_out_report()
+
+uint32_t scenario_rand();
+
+void scenario_config();
+void scenario_connect();
+void scenario_setup(uint8_t descriptor_number);
+
+// Advances fake_time by a millisecond and feeds this frame's randomized input reports.
+void scenario_input(uint32_t frame);
+// One main loop iteration: input, process_mapping() and draining the outgoing queue.
+void scenario_frame(uint32_t frame);
+
+bool capture_report(uint8_t interface, const uint8_t* report_with_id, uint8_t len);
+
+#endif
@@ -0,0 +1,114 @@
+// The input_state slot lookup table against std::unordered_map, plus lookups
+// per second of both on a config that uses all 1024 slots.
+
+#include <chrono>
+
+#include "../src/remapper.cc"
+
+#include "scenario.h"
+#include "test.h"
+
+static std::unordered_map<uint64_t, int32_t> reference;
+
+static uint64_t random_key() {
+    static const uint32_t pages[] = { 0x00010000, 0x00070000, 0x00090000, 0x000C0000, 0xFFF30000, 0xFFF40000 };
+    uint32_t usage = pages[scenario_rand() % 6] | (scenario_rand() % 0x300);
+    return state_key(usage, scenario_rand() % 8, scenario_rand() % 4 == 0);
+}
+
+static void check_all() {
+    for (auto const& [key, slot] : reference) {
+        CHECK_EQ(find_state_slot(key), slot);
+    }
+    for (int i = 0; i < 1000; i++) {
+        uint64_t key = random_key();
+        if (reference.count(key) == 0) {
+            CHECK_EQ(find_state_slot(key), -1);
+        }
+    }
+}
+
+static void fill(uint32_t n, bool sequential) {
+    reference.clear();
+    used_state_slots = 0;
+    clear_state_table();
+    for (uint32_t i = 0; (reference.size() < n) && (test_failures < FAILURE_LIMIT); i++) {
+        uint32_t usage = sequential ? (0x00070000 | i) : 0;
+        uint8_t hub_port = 0;
+        bool raw = false;
+        if (!sequential) {
+            uint64_t key = random_key();
+            usage = key & 0xFFFFFFFF;
+            hub_port = (key >> 32) & 0xFF;
+            raw = key >> 40;
+        }
+        CHECK(assign_state_slot(usage, hub_port, raw));
+        uint64_t key = state_key(usage, hub_port, raw);
+        if (reference.count(key) == 0) {
+            reference[key] = used_state_slots - 1;
+        }
+        CHECK_EQ(used_state_slots, reference.size());
+        CHECK_EQ(find_state_slot(key), reference[key]);
+        CHECK(get_state_ptr(usage, hub_port, false, raw) == input_state + reference[key]);
+    }
+    check_all();
+    rebuild_state_table();
+    check_all();
+}
+
+int main() {
+    for (uint32_t n : { 1, 10, 100, 500, 1000, MAX_INPUT_STATES }) {
+        fill(n, false);
+        uint32_t random_max_probe = state_table_max_probe;
+        fill(n, true);
+        printf("%4u slots: longest probe sequence %u (random keys), %u (sequential keys)\n", n, random_max_probe, state_table_max_probe);
+        CHECK(random_max_probe < 16);
+        CHECK(state_table_max_probe < 16);
+    }
+
+    // full
+    printf("expect an out of slots message: ");
+    CHECK(!assign_state_slot(0x00070000 | 0xFFFF, 0, false));
+    CHECK(assign_state_slot(0x00070000 | 0x0100, 0, false));  // already there
+    CHECK_EQ(used_state_slots, MAX_INPUT_STATES);
+    printf("\n");
+
+    // what a real mapping ends up with, padded out to every slot with more mappings
+    scenario_setup(0);
+    uint32_t extra = 0;
+    while (used_state_slots < MAX_INPUT_STATES) {
+        for (uint32_t n = MAX_INPUT_STATES - used_state_slots; n > 0; n--, extra++) {
+            config_mappings.push_back((mapping_config11_t){ 0x00070004, 0x00070100 + extra, 1000, 1, 0, 0 });
+        }
+        set_mapping_from_config();
+    }
+    CHECK_EQ(used_state_slots, MAX_INPUT_STATES);
+    reference.clear();
+    for (uint32_t slot = 0; slot < used_state_slots; slot++) {
+        reference[state_slot_key[slot]] = slot;
+    }
+    CHECK_EQ(reference.size(), used_state_slots);
+    check_all();
+
+    const uint32_t lookups = 2000000;
+    std::vector<uint64_t> keys;
+    for (auto const& [key, slot] : reference) {
+        keys.push_back(key);
+    }
+    uint32_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < lookups; i++) {
+        sum += find_state_slot(keys[i % keys.size()]);
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < lookups; i++) {
+        sum += reference.find(keys[i % keys.size()])->second;
+    }
+    auto end = std::chrono::steady_clock::now();
+    long long table_us = std::chrono::duration_cast<std::chrono::microseconds>(middle - start).count();
+    long long map_us = std::chrono::duration_cast<std::chrono::microseconds>(end - middle).count();
+    printf("%zu mappings, %zu slots: state table %lld lookups/s, unordered_map %lld lookups/s (%u)\n",
+        config_mappings.size(), keys.size(), lookups * 1000000LL / std::max(table_us, 1LL), lookups * 1000000LL / std::max(map_us, 1LL), sum);
+
+    return test_result("state_table_test");
+}
@@ -0,0 +1,61 @@
+#include "platform.h"
+#include "remapper.h"
+#include "scenario.h"
+
+uint64_t fake_time = 0;
+
+std::vector<captured_report_t> captured_out_reports;
+
+void do_persist_config(uint8_t* buffer) {
+}
+
+void reset_to_bootloader() {
+}
+
+void pair_new_device() {
+}
+
+void clear_bonds() {
+}
+
+void flash_b_side() {
+}
+
+void my_mutexes_init() {
+}
+
+void my_mutex_enter(MutexId id) {
+}
+
+void my_mutex_exit(MutexId id) {
+}
+
+uint64_t get_time() {
+    return fake_time;
+}
+
+uint64_t get_unique_id() {
+    return 0x0123456789ABCDEF;
+}
+
+uint32_t get_gpio_valid_pins_mask() {
+    return 0;
+}
+
+void set_gpio_inout_masks(uint32_t in_mask, uint32_t out_mask) {
+}
+
+void interval_override_updated() {
+}
+
+void queue_out_report(uint16_t interface, uint8_t report_id, const uint8_t* buffer, uint8_t len) {
+    captured_report_t captured = { .interface = interface, .report_id = report_id };
+    captured.data.assign(buffer, buffer + len);
+    captured_out_reports.push_back(captured);
+}
+
+void queue_set_feature_report(uint16_t interface, uint8_t report_id, const uint8_t* buffer, uint8_t len) {
+}
+
+void queue_get_feature_report(uint16_t interface, uint8_t report_id, uint8_t len) {
+}
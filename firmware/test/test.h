@@ -0,0 +1,35 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+inline int test_failures = 0;
+
+#define CHECK(cond)                                                       \
+    do {                                                                  \
+        if (!(cond)) {                                                    \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                              \
+        }                                                                 \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                              \
+    do {                                                                            \
+        long long a_ = (long long) (a);                                             \
+        long long b_ = (long long) (b);                                             \
+        if (a_ != b_) {                                                             \
+            printf("%s:%d: %s == %s failed (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+            test_failures++;                                                        \
+        }                                                                           \
+    } while (0)
+
+// Stop after this many failures so that a broken invariant doesn't print a line per frame.
+#define FAILURE_LIMIT 20
+
+inline int test_result(const char* name) {
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "OK");
+    return test_failures ? 1 : 0;
+}
+
+#endif